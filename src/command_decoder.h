@@ -0,0 +1,409 @@
+#ifndef COMMANDDECODER_H
+#define COMMANDDECODER_H
+
+#include <instruction_set.h>
+#include <wave_decoder.h>
+#include <synth.h>
+
+/// シンセ命令 (instruction_set.h) のデコーダ
+/// I2C・UART MIDI・ホスト用レンダラで共通に使用する
+/// デバイス固有の命令 (プリセット、統計取得) は main.cpp で処理する
+class CommandDecoder {
+private:
+    WaveGenerator& wave;
+
+    uint16_t buff_i = 0;        // ユーザー波形のバッファカウント用
+    int16_t cshape_buff[2048];  // ユーザー波形のバッファ
+    WaveDecoder cshape_decoder; // 圧縮ユーザー波形のデコーダ
+    uint8_t cshape_owner = 0x00; // バッファを使用中の命令 (SYNTH_SET_CSHAPE / SYNTH_SET_CZSHAPE)
+
+    /**
+     * @brief ユーザー波形のバッファを命令に割り当てます
+     * 別の命令が転送途中だった場合はその内容を破棄し、混ざらないようにする
+     */
+    void claimShapeBuffer(uint8_t instruction) {
+        if(cshape_owner == instruction) return;
+        cshape_owner = instruction;
+        buff_i = 0;
+        cshape_decoder.begin(nullptr);
+    }
+
+public:
+    CommandDecoder(WaveGenerator& wave): wave(wave) {}
+
+    /**
+     * @brief 1命令分のデータを処理します
+     * @param response 応答がある命令の場合に書き込まれる
+     * @return 対応する命令だった場合 true
+     */
+    bool process(const uint8_t* receivedData, int bytes, uint8_t* response) {
+        if(bytes < 1) return false;
+
+        // 命令コードを取得
+        uint8_t instruction = receivedData[0];
+
+        // 命令コードに応じた処理
+        switch (instruction)
+        {
+            // 例: {SYNTH_NOTE_ON, <note>, <velocity>}
+            case SYNTH_NOTE_ON:
+                if(bytes < 3) return true;
+                {
+                    uint8_t note = receivedData[1];
+                    uint8_t velocity = receivedData[2];
+                    wave.noteOn(note, velocity);
+                }
+                break;
+
+            // 例: {SYNTH_NOTE_OFF, <note>, <velocity>}
+            case SYNTH_NOTE_OFF:
+                if(bytes < 3) return true;
+                {
+                    uint8_t note = receivedData[1];
+                    wave.noteOff(note);
+                }
+                break;
+
+            // 例: {SYNTH_CTRL_CHANGE, <cc>, <value>}
+            case SYNTH_CTRL_CHANGE:
+                if(bytes < 3) return true;
+                {
+                    wave.controlChange(receivedData[1], receivedData[2]);
+                }
+                break;
+
+            // 例: {SYNTH_PITCH_BEND, <LSB>, <MSB>}
+            case SYNTH_PITCH_BEND:
+                if(bytes < 3) return true;
+                {
+                    int16_t bend = ((receivedData[2] << 7) | (receivedData[1] & 0x7F)) - 8192;
+                    wave.setPitchBend(bend);
+                }
+                break;
+
+            // 例: {SYNTH_SET_SHAPE, <id>, <osc>}
+            case SYNTH_SET_SHAPE:
+                if(bytes < 3) return true;
+                {
+                    wave.setShape(receivedData[1], receivedData[2]);
+                }
+                break;
+
+            // 例: {SYNTH_SOUND_STOP}
+            case SYNTH_SOUND_STOP:
+                wave.noteReset();
+                break;
+
+            // 例: {SYNTH_SET_PAN, <pan>}
+            case SYNTH_SET_PAN:
+                if(bytes < 2) return true;
+                wave.setAmpPan(receivedData[1]);
+                break;
+
+            // 例: {SYNTH_SET_ATTACK, <sec>, <msec>, <msec>, <msec>, <msec>}
+            case SYNTH_SET_ATTACK:
+            case SYNTH_SET_DECAY:
+            case SYNTH_SET_RELEASE:
+                if(bytes < 6) return true;
+                {
+                    int16_t data = 0;
+                    data += receivedData[1] * 1000;
+                    data += receivedData[2];
+                    data += receivedData[3];
+                    data += receivedData[4];
+                    data += receivedData[5];
+                    if(instruction == SYNTH_SET_ATTACK) {
+                        wave.setAttack(data);
+                    }
+                    else if(instruction == SYNTH_SET_DECAY) {
+                        wave.setDecay(data);
+                    }
+                    else if(instruction == SYNTH_SET_RELEASE) {
+                        wave.setRelease(data);
+                    }
+                }
+                break;
+
+            // 例: {SYNTH_SET_SUSTAIN, <msec>, <msec>, <msec>, <msec>}
+            case SYNTH_SET_SUSTAIN:
+                if(bytes < 5) return true;
+                {
+                    int16_t sustain = 0;
+                    sustain += receivedData[1];
+                    sustain += receivedData[2];
+                    sustain += receivedData[3];
+                    sustain += receivedData[4];
+                    wave.setSustain(sustain);
+                }
+                break;
+
+            // 例: {SYNTH_GET_USED}
+            case SYNTH_GET_USED:
+                *response = wave.getActiveNote();
+                break;
+
+            // 例: {SYNTH_IS_NOTE, <note>}
+            case SYNTH_IS_NOTE:
+                if(wave.isNote(receivedData[1])) *response = 0x01;
+                else *response = 0x00;
+                break;
+
+            // 例: {SYNTH_SET_CSHAPE, 0x01, 0x02, WAVE_DATA...}
+            case SYNTH_SET_CSHAPE:
+                if(bytes < 27) return true;
+                {
+                    claimShapeBuffer(SYNTH_SET_CSHAPE);
+                    for(uint16_t i = 0; i < 27; i++) {
+                        if(i < 3) continue;
+                        if(buff_i == 2048) {
+                            if(!wave.setCustomShape(cshape_buff, receivedData[2])) *response = RES_ERROR;
+                            buff_i = 0;
+                            break;
+                        }
+                        if(buff_i == 0) memset(cshape_buff, 0, 2048 * sizeof(int16_t));
+                        cshape_buff[buff_i] = static_cast<int16_t>((receivedData[i+1] << 8) | receivedData[i]);
+                        i++;
+                        buff_i++;
+                    }
+                }
+                break;
+
+            // 例: {SYNTH_SET_CZSHAPE, 0x01(先頭)|0x00(続き), <osc>, ENCODED_DATA...}
+            case SYNTH_SET_CZSHAPE:
+                if(bytes < 3) return true;
+                {
+                    claimShapeBuffer(SYNTH_SET_CZSHAPE);
+                    if(receivedData[1] == 0x01) {
+                        memset(cshape_buff, 0, 2048 * sizeof(int16_t));
+                        cshape_decoder.begin(cshape_buff);
+                    }
+                    if(cshape_decoder.decode(&receivedData[3], bytes - 3)) {
+                        if(!wave.setCustomShape(cshape_buff, receivedData[2])) *response = RES_ERROR;
+                        cshape_decoder.begin(nullptr);
+                    }
+                }
+                break;
+
+            // 例: {SYNTH_SET_VOICE, <voice>, <osc>}
+            case SYNTH_SET_VOICE:
+                if(bytes < 3) return true;
+                {
+                    wave.setVoice(receivedData[1], receivedData[2]);
+                }
+                break;
+
+            // 例: {SYNTH_SET_DETUNE, <detune>, <osc>}
+            case SYNTH_SET_DETUNE:
+                if(bytes < 3) return true;
+                {
+                    wave.setDetune(receivedData[1], receivedData[2]);
+                }
+                break;
+
+            // 例: {SYNTH_SET_SPREAD, <spread>, <osc>}
+            case SYNTH_SET_SPREAD:
+                if(bytes < 3) return true;
+                {
+                    wave.setSpread(receivedData[1], receivedData[2]);
+                }
+                break;
+
+            // 例: {SYNTH_SET_LPF, <bool>, 0x22...}
+            // 例: {SYNTH_SET_LPF, 0x00(false)}
+            case SYNTH_SET_LPF:
+                if(bytes < 2) return true;
+                {
+                    if(receivedData[1] == 0x01){
+                        float freq, q;
+                        uint8_t d_freq[] = {receivedData[2], receivedData[3], receivedData[4], receivedData[5]};
+                        uint8_t d_q[] = {receivedData[6], receivedData[7], receivedData[8], receivedData[9]};
+                        memcpy(&freq, d_freq, sizeof(float));
+                        memcpy(&q, d_q, sizeof(float));
+                        wave.setLowPassFilter(true, freq, q);
+                    } else {
+                        wave.setLowPassFilter(false);
+                    }
+                }
+                break;
+
+            // 例: {SYNTH_SET_HPF, <bool>, 0x22...}
+            // 例: {SYNTH_SET_HPF, 0x00(false)}
+            case SYNTH_SET_HPF:
+                if(bytes < 2) return true;
+                {
+                    if(receivedData[1] == 0x01){
+                        float freq, q;
+                        uint8_t d_freq[] = {receivedData[2], receivedData[3], receivedData[4], receivedData[5]};
+                        uint8_t d_q[] = {receivedData[6], receivedData[7], receivedData[8], receivedData[9]};
+                        memcpy(&freq, d_freq, sizeof(float));
+                        memcpy(&q, d_q, sizeof(float));
+                        wave.setHighPassFilter(true, freq, q);
+                    } else {
+                        wave.setHighPassFilter(false);
+                    }
+                }
+                break;
+
+            // 例: {SYNTH_SET_OSC_LVL, <OSC>, <HB_Level>, <LB_Level>}
+            case SYNTH_SET_OSC_LVL:
+                if(bytes < 4) return true;
+                {
+                    wave.setOscLevel(receivedData[1], (receivedData[2] << 8) | receivedData[3]);
+                }
+                break;
+
+            // 例: {SYNTH_SET_OCT, <osc>, <octave>}
+            case SYNTH_SET_OCT:
+                if(bytes < 3) return true;
+                {
+                    wave.setOscOctave(receivedData[1], static_cast<int8_t>(receivedData[2]));
+                }
+                break;
+
+            // 例: {SYNTH_SET_SEMI, <osc>, <semitone>}
+            case SYNTH_SET_SEMI:
+                if(bytes < 3) return true;
+                {
+                    wave.setOscSemitone(receivedData[1], static_cast<int8_t>(receivedData[2]));
+                }
+                break;
+
+            // 例: {SYNTH_SET_CENT, <osc>, <cent>}
+            case SYNTH_SET_CENT:
+                if(bytes < 3) return true;
+                {
+                    wave.setOscCent(receivedData[1], static_cast<int8_t>(receivedData[2]));
+                }
+                break;
+
+            // 例: {SYNTH_SET_OSC_PAN, <osc>, <pan>}
+            case SYNTH_SET_OSC_PAN:
+                if(bytes < 3) return true;
+                {
+                    wave.setOscPan(receivedData[1], receivedData[2]);
+                }
+                break;
+
+            // 例: {SYNTH_SET_LEVEL, <HB_level>, <LB_level>}
+            case SYNTH_SET_LEVEL:
+                if(bytes < 3) return true;
+                {
+                    wave.setAmpLevel((receivedData[1] << 8) | receivedData[2]);
+                }
+                break;
+
+            // 例: {SYNTH_SET_DELAY, <true|false>, <HB_time>, <LB_time>, <HB_level>, <LB_level>, <HB_feedback>, <LB_feedback>}
+            case SYNTH_SET_DELAY:
+                if(bytes < 8) return true;
+                {
+                    if(receivedData[1] == 0x01) {
+                        int16_t time = static_cast<int16_t>((receivedData[2] << 8) | receivedData[3]);
+                        int16_t level = static_cast<int16_t>((receivedData[4] << 8) | receivedData[5]);
+                        int16_t feedback = static_cast<int16_t>((receivedData[6] << 8) | receivedData[7]);
+                        if(!wave.setDelay(true, time, level, feedback)) *response = RES_ERROR;
+                    }
+                    else {
+                        wave.setDelay(false);
+                    }
+                }
+                break;
+
+            // 例: {SYNTH_SET_MOD, <mod>}
+            case SYNTH_SET_MOD:
+                if(bytes < 2) return true;
+                {
+                    wave.setMod(receivedData[1]);
+                }
+                break;
+
+            // 例: {SYNTH_SET_MONO, <0x00: ポリ | 0x01: モノ | 0x02: レガート>}
+            case SYNTH_SET_MONO:
+                if(bytes < 2) return true;
+                {
+                    if(receivedData[1] == 0x01) wave.setMonophonic(true);
+                    else if(receivedData[1] == 0x02) wave.setMonophonic(true, true);
+                    else wave.setMonophonic(false);
+                }
+                break;
+
+            // 例: {SYNTH_SET_GLIDE, <true|false>, <HB_time>, <LB_time>}
+            case SYNTH_SET_GLIDE:
+                if(bytes < 2) return true;
+                {
+                    if(receivedData[1] == 0x01) {
+                        if(bytes >= 4) {
+                            uint16_t time = static_cast<uint16_t>((receivedData[2] << 8) | receivedData[3]);
+                            wave.setGlideMode(true, time);
+                        }
+                        else wave.setGlideMode(true);
+                    }
+                    else {
+                        wave.setGlideMode(false);
+                    }
+                }
+                break;
+
+            // 例: {SYNTH_SET_FM_INDEX, <HB_index>, <LB_index>}
+            case SYNTH_SET_FM_INDEX:
+                if(bytes < 3) return true;
+                {
+                    wave.setFmIndex((receivedData[1] << 8) | receivedData[2]);
+                }
+                break;
+
+            // 例: {SYNTH_SET_NOISE, <0x00(なし)|0x01(ホワイト)|0x02(ピンク)>, <HB_level>, <LB_level>}
+            case SYNTH_SET_NOISE:
+                if(bytes < 4) return true;
+                {
+                    wave.setNoise(receivedData[1]);
+                    wave.setNoiseLevel((receivedData[2] << 8) | receivedData[3]);
+                }
+                break;
+
+            // 例: {SYNTH_SET_OVERSAMPLE, <true|false>}
+            case SYNTH_SET_OVERSAMPLE:
+                if(bytes < 2) return true;
+                {
+                    wave.setOversampling(receivedData[1] == 0x01);
+                }
+                break;
+
+            // 例: {SYNTH_RESET_PARAM}
+            case SYNTH_RESET_PARAM:
+                if(bytes < 1) return true;
+                {
+                    wave.resetParam();
+                }
+                break;
+
+            default:
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief バッチフレームをまとめて適用します (ホスト用)
+     * 派生値の計算は最後に一度だけ行われます
+     * 本体では main.cpp の applyBatch() がブロック境界で適用する
+     * 例: {SYNTH_SET_BATCH, <size>, <命令...>, <size>, <命令...>, ...}
+     */
+    void applyBatch(const uint8_t* data, int bytes, uint8_t* response) {
+        wave.beginUpdate();
+
+        int i = 1;
+        while(i < bytes) {
+            uint8_t size = data[i];
+            i++;
+            if(size < 1 || i + size > bytes) break;
+            if(data[i] != SYNTH_SET_BATCH) {
+                process(&data[i], size, response);
+            }
+            i += size;
+        }
+
+        wave.endUpdate();
+    }
+};
+
+#endif // COMMANDDECODER_H
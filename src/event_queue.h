@@ -0,0 +1,102 @@
+#ifndef EVENTQUEUE_H
+#define EVENTQUEUE_H
+
+#include <instruction_set.h>
+
+#define EVENT_SLOTS    32 // 予約できる命令の数
+#define EVENT_DATA_MAX 3  // ノート・CC・ピッチベンド
+
+/// サンプル位置を指定して予約した演奏命令 (時刻順)
+///
+/// 受信側 (I2C割り込み・UART MIDI) が push() し、メインループがブロックを
+/// 命令の位置で区切って pop() する。両者が同時に触れないよう、
+/// 割り込みを止めた状態で呼ぶこと。
+class EventQueue {
+public:
+    /**
+     * @brief サンプル位置で予約する命令か (演奏命令)
+     * パラメータ命令は受信時に直ちに適用する
+     */
+    static bool isTimed(uint8_t instruction) {
+        switch(instruction) {
+            case SYNTH_NOTE_ON:
+            case SYNTH_NOTE_OFF:
+            case SYNTH_CTRL_CHANGE:
+            case SYNTH_PITCH_BEND:
+                return true;
+        }
+        return false;
+    }
+
+    struct Event {
+        uint32_t sample; // 適用するサンプルクロック
+        uint8_t channel; // MIDIチャンネル (I2C命令は PART_OMNI)
+        uint8_t size;
+        uint8_t data[EVENT_DATA_MAX];
+    };
+
+private:
+    Event events[EVENT_SLOTS];
+    uint8_t head = 0; // 最も早い命令
+    uint8_t count = 0;
+    uint32_t dropped = 0;
+
+public:
+    /**
+     * @brief 命令を予約します (同じ時刻の命令は受信順)
+     * @return 空きが無い場合 false
+     */
+    bool push(uint32_t sample, const uint8_t* data, uint8_t size, uint8_t channel) {
+        if(count >= EVENT_SLOTS || size < 1 || size > EVENT_DATA_MAX) {
+            dropped++;
+            return false;
+        }
+
+        // 後ろから挿入位置を探す (ほとんどの場合は末尾)
+        uint8_t n = count;
+        while(n > 0) {
+            const Event& prev = events[(head + n - 1) % EVENT_SLOTS];
+            if((int32_t)(sample - prev.sample) >= 0) break;
+            events[(head + n) % EVENT_SLOTS] = prev;
+            n--;
+        }
+
+        Event& e = events[(head + n) % EVENT_SLOTS];
+        e.sample = sample;
+        e.channel = channel;
+        e.size = size;
+        memcpy(e.data, data, size);
+        count++;
+        return true;
+    }
+
+    bool isEmpty() {
+        return count == 0;
+    }
+
+    /**
+     * @brief 次の命令を取得します
+     * @return 空の場合 nullptr
+     */
+    const Event* peek() {
+        return count > 0 ? &events[head] : nullptr;
+    }
+
+    void pop() {
+        if(count == 0) return;
+        head = (head + 1) % EVENT_SLOTS;
+        count--;
+    }
+
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+
+    // 空きが無く直ちに適用した命令の数
+    uint32_t getDropped() {
+        return dropped;
+    }
+};
+
+#endif // EVENTQUEUE_H
@@ -0,0 +1,69 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+/// 負荷に応じた段階的な品質低下 (WaveGenerator::setGovernorLevel)
+#define GOV_NORMAL        0 // 通常
+#define GOV_STEAL_RELEASE 1 // リリース中のノートを早めに停止
+#define GOV_UNISON_QUIET  2 // 音量の小さいノートのユニゾンを半分に
+#define GOV_UNISON_ALL    3 // 全ノートのユニゾンを半分に
+#define GOV_SKIP_SUB      4 // サブOSCを省略
+#define GOV_LEVEL_MAX     4
+
+#define GOV_HIGH     850 // この負荷(千分率)を超えたら1段階下げる
+#define GOV_LOW      600 // この負荷を下回り続けたら1段階戻す
+#define GOV_COOLDOWN 2048  // 段階を下げた後に様子を見るサンプル数 (256サンプルで8ブロック)
+#define GOV_HOLD     24576 // 段階を戻すまでのサンプル数 (48kHzで約0.5秒)
+
+/// ブロック毎の負荷からレベルを決める (ヒステリシスあり)
+/// 待ち時間はサンプル数で数え、バッファサイズを切り替えても同じ時間になるようにする
+class VoiceGovernor {
+private:
+    uint8_t level = GOV_NORMAL;
+    uint16_t cooldown = 0; // サンプル
+    uint32_t calm = 0;     // サンプル
+    uint32_t escalations = 0;
+
+public:
+    /**
+     * @brief 1ブロックの負荷を渡し、次のブロックのレベルを返します
+     * @param load 締め切りに対する千分率
+     * @param samples ブロックのサンプル数
+     */
+    uint8_t update(uint16_t load, uint16_t samples) {
+        cooldown = cooldown > samples ? cooldown - samples : 0;
+
+        if(load > GOV_HIGH) {
+            calm = 0;
+            if(cooldown == 0 && level < GOV_LEVEL_MAX) {
+                level++;
+                escalations++;
+                cooldown = GOV_COOLDOWN;
+            }
+        }
+        else if(load < GOV_LOW) {
+            if(level > GOV_NORMAL && (calm += samples) >= GOV_HOLD) {
+                level--;
+                calm = 0;
+            }
+        }
+        else {
+            calm = 0;
+        }
+
+        return level;
+    }
+
+    uint8_t getLevel() {
+        return level;
+    }
+
+    uint32_t getEscalations() {
+        return escalations;
+    }
+
+    void resetCount() {
+        escalations = 0;
+    }
+};
+
+#endif // GOVERNOR_H
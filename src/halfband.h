@@ -0,0 +1,56 @@
+#ifndef HALFBAND_H
+#define HALFBAND_H
+
+#define HB_TAPS  7  // 片側の係数の数 (27タップ, 中央以外の偶数番目は0)
+#define HB_DELAY 6  // 中央タップの遅延 (出力サンプル)
+#define HB_HIST  16 // 履歴のリングバッファ (2の累乗)
+
+/// 2倍オーバーサンプリングからのデシメーション用ハーフバンドフィルタ
+///
+/// 27タップ (カイザー窓 beta=5) をポリフェーズに分解し、
+/// 1出力あたり乗算7回 (対称係数の前加算) と中央タップのシフトで処理する。
+/// 通過域 ~18kHz, 阻止域 30kHz~ で約 -54dB (96kHz動作時)。
+class HalfBandDecimator {
+private:
+    // 係数 Q15 (外側から中央へ), 中央タップは 0.5
+    const int16_t coef[HB_TAPS] = {29, -130, 344, -744, 1482, -3083, 10294};
+
+    int16_t hist_a[HB_HIST]; // 1つ目のサンプル (中央タップ用)
+    int16_t hist_b[HB_HIST]; // 2つ目のサンプル (対称タップ用)
+    uint8_t pos = 0;
+
+public:
+    HalfBandDecimator() {
+        reset();
+    }
+
+    void reset() {
+        memset(hist_a, 0, sizeof(hist_a));
+        memset(hist_b, 0, sizeof(hist_b));
+        pos = 0;
+    }
+
+    /**
+     * @brief 2サンプルを1サンプルに間引きます
+     * @param a 時間的に先のサンプル
+     * @param b 後のサンプル
+     */
+    int16_t process(int16_t a, int16_t b) {
+        pos = (pos + 1) & (HB_HIST - 1);
+        hist_a[pos] = a;
+        hist_b[pos] = b;
+
+        int32_t acc = (int32_t)hist_a[(pos - HB_DELAY) & (HB_HIST - 1)] << 14;
+        for(uint8_t k = 0; k < HB_TAPS; ++k) {
+            int32_t pair = hist_b[(pos - k) & (HB_HIST - 1)] + hist_b[(pos - (2 * HB_DELAY + 1) + k) & (HB_HIST - 1)];
+            acc += coef[k] * pair;
+        }
+
+        acc = (acc + (1 << 14)) >> 15;
+        if(acc > INT16_MAX) acc = INT16_MAX;
+        else if(acc < INT16_MIN) acc = INT16_MIN;
+        return acc;
+    }
+};
+
+#endif // HALFBAND_H
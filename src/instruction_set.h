@@ -45,10 +45,31 @@
 #define SYNTH_SET_MONO    0xD6 // モノフォニックを設定
 #define SYNTH_SET_GLIDE   0xD7 // グライドを設定
 #define SYNTH_RESET_PARAM 0xD8 // パラメータをリセット
+#define SYNTH_SET_CZSHAPE 0xD9 // 圧縮カスタムシェイプを設定
+#define SYNTH_SET_BATCH   0xDA // 複数の命令をまとめて適用
+#define SYNTH_SAVE_PRESET 0xDB // プリセットスロットへ保存
+#define SYNTH_LOAD_PRESET 0xDC // プリセットスロットから読み出し
+#define SYNTH_CTRL_CHANGE 0xDD // コントロールチェンジ (MIDI CC)
+#define SYNTH_PITCH_BEND  0xDE // ピッチベンド
+#define SYNTH_GET_LATENCY 0xDF // ノートオン遅延のヒストグラムを取得
+#define SYNTH_GET_LOAD    0xE0 // 処理負荷とアンダーラン回数を取得
+#define SYNTH_DUMP_TRACE  0xE1 // 受信フレームの記録をSerial2へ出力
+#define SYNTH_SET_OVERSAMPLE 0xE2 // 2倍オーバーサンプリングを設定
+#define SYNTH_SET_FM_INDEX 0xE3 // FMの変調量を設定
+#define SYNTH_SET_OSC_PAN 0xE4 // OSCごとのパンを設定
+#define SYNTH_SET_PROFILE 0xE5 // バッファサイズとサンプリング周波数を切り替え
+#define SYNTH_SET_PLAY_MODE 0xE6 // 演奏モード (POLY/MONO/DUAL/MULTI/LEGATO) を設定
+#define SYNTH_SET_PART    0xE7 // パートのチャンネル・キー範囲・発音数を設定
+#define SYNTH_EDIT_PART   0xE8 // パラメータ命令の送り先パートを選択
+#define SYNTH_GET_STATUS  0xE9 // 空きボイス・各ノートの状態・負荷・入れ替え候補を取得
+#define SYNTH_SET_NOISE   0xEA // ノイズOSCの種類とレベルを設定
+#define SYNTH_SCHEDULE    0xEB // 演奏命令をサンプル単位の遅延を付けて予約
+#define SYNTH_GET_MEMORY  0xEC // 遅延線・ユーザー波形の領域の使用量を取得
 
 
 /// 共通シンセ演奏状態コード
-#define SYNTH_POLY  0x00
-#define SYNTH_MONO  0x01
-#define SYNTH_DUAL  0x02
-#define SYNTH_MULTI 0x03
\ No newline at end of file
+#define SYNTH_POLY   0x00
+#define SYNTH_MONO   0x01
+#define SYNTH_DUAL   0x02
+#define SYNTH_MULTI  0x03
+#define SYNTH_LEGATO 0x04
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#define LAT_BUCKETS    32  // バケット数 (最後のバケットは上限超過分)
+#define LAT_BUCKET_US  500 // バケット幅 (us)
+#define LAT_DATA_SIZE  (LAT_BUCKETS * 2 + 10)
+
+/// イベント到着から最初の発音サンプル出力までの遅延ヒストグラム
+class LatencyHistogram {
+private:
+    uint16_t count[LAT_BUCKETS];
+    uint32_t total;   // 記録数
+    uint64_t sum_us;  // 平均用
+    uint16_t min_us;
+    uint16_t max_us;
+
+public:
+    LatencyHistogram() {
+        reset();
+    }
+
+    void reset() {
+        memset(count, 0, sizeof(count));
+        total = 0;
+        sum_us = 0;
+        min_us = UINT16_MAX;
+        max_us = 0;
+    }
+
+    void add(uint32_t us) {
+        if(us > UINT16_MAX) us = UINT16_MAX;
+
+        uint32_t bucket = us / LAT_BUCKET_US;
+        if(bucket >= LAT_BUCKETS) bucket = LAT_BUCKETS - 1;
+        if(count[bucket] < UINT16_MAX) count[bucket]++;
+
+        total++;
+        sum_us += us;
+        if(us < min_us) min_us = us;
+        if(us > max_us) max_us = us;
+    }
+
+    /**
+     * @brief ヒストグラムをバイト列にします (リトルエンディアン)
+     * {count[0..LAT_BUCKETS-1](u16), total(u32), min(u16), max(u16), avg(u16)}
+     * @return 書き込んだバイト数 (LAT_DATA_SIZE)
+     */
+    uint8_t serialize(uint8_t* out) {
+        uint8_t i = 0;
+        for(uint8_t b = 0; b < LAT_BUCKETS; ++b) {
+            out[i++] = count[b] & 0xFF;
+            out[i++] = count[b] >> 8;
+        }
+        for(uint8_t b = 0; b < 4; ++b) {
+            out[i++] = (total >> (b * 8)) & 0xFF;
+        }
+        uint16_t min = total > 0 ? min_us : 0;
+        uint16_t avg = total > 0 ? sum_us / total : 0;
+        out[i++] = min & 0xFF;
+        out[i++] = min >> 8;
+        out[i++] = max_us & 0xFF;
+        out[i++] = max_us >> 8;
+        out[i++] = avg & 0xFF;
+        out[i++] = avg >> 8;
+        return i;
+    }
+};
+
+#endif // LATENCYSTATS_H
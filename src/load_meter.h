@@ -0,0 +1,56 @@
+#ifndef LOADMETER_H
+#define LOADMETER_H
+
+/// ブロック毎の処理負荷 (締め切りに対する千分率)
+class LoadMeter {
+private:
+    uint32_t deadline_us = 1;
+    int32_t average = 0;   // 指数移動平均 <<4
+    uint16_t last = 0;     // 直前のブロック
+    uint16_t peak = 0;
+
+public:
+    /**
+     * @brief 1ブロックの締め切り時間を設定します
+     */
+    void setDeadline(uint32_t us) {
+        deadline_us = us > 0 ? us : 1;
+    }
+
+    uint32_t getDeadline() {
+        return deadline_us;
+    }
+
+    void reset() {
+        average = 0;
+        last = 0;
+        peak = 0;
+    }
+
+    /**
+     * @brief 1ブロックの処理時間を記録します
+     */
+    void add(uint32_t busy_us) {
+        uint32_t load = (busy_us * 1000) / deadline_us;
+        if(load > UINT16_MAX) load = UINT16_MAX;
+
+        last = load;
+        if(last > peak) peak = last;
+        average += ((int32_t)(load << 4) - average) >> 4;
+    }
+
+    // 千分率 (1000 = 締め切りちょうど)
+    uint16_t getLast() {
+        return last;
+    }
+
+    uint16_t getAverage() {
+        return average >> 4;
+    }
+
+    uint16_t getPeak() {
+        return peak;
+    }
+};
+
+#endif // LOADMETER_H
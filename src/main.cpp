@@ -2,8 +2,19 @@
 #include <I2S.h>
 #include <Wire.h>
 #include <synth.h>
+#include <sram_arena.h>
 #include <instruction_set.h>
 #include <ring_buffer.h>
+#include <command_decoder.h>
+#include <preset_store.h>
+#include <midi_parser.h>
+#include <latency_stats.h>
+#include <load_meter.h>
+#include <governor.h>
+#include <trace_buffer.h>
+#include <part_router.h>
+#include <synth_status.h>
+#include <event_queue.h>
 
 // SynthIDを選択
 #define SYNTH_ID 1 // 1 or 2
@@ -21,46 +32,170 @@ TwoWire& i2c = Wire;
 #define SDA_PIN 0
 #define SCL_PIN 1
 
+// UART MIDI 入力 (Serial2)
+// 1: MIDI IN として使用 (31250bps, デバッグ出力は使用不可)
+// 0: デバッグ用 (115200bps)
+#define UART_MIDI 0
+#define UART_MIDI_CHANNEL MIDI_OMNI // 受信チャンネル 0~15 or MIDI_OMNI
+
 // DAC 関連
 #define PIN_I2S_DOUT 20
 #define PIN_I2S_BCLK 21
 #define PIN_I2S_LRCLK 22
-#define BUFFER_SIZE 256
+#define BUFFER_SIZE 256 // 最大のバッファサイズ (起動時の値)
 
 I2S i2s(OUTPUT);
 #define SAMPLE_BITS 16    // サンプリングビット数
-#define SAMPLE_RATE 48000 // サンプリング周波数
+#define SAMPLE_RATE 48000 // サンプリング周波数 (起動時の値)
+
+// オーディオプロファイル (SYNTH_SET_PROFILE で切り替え)
+// バッファが小さいほど出力遅延は減るが、ブロック毎の処理が増えて同時発音の余裕が減る
+const uint16_t PROFILE_BUFFER[4] = {32, 64, 128, 256};
+const uint32_t PROFILE_RATE[2] = {48000, 44100};
+uint16_t buffer_size = BUFFER_SIZE; // 現在のバッファサイズ
+uint32_t sample_rate = SAMPLE_RATE; // 現在のサンプリング周波数
+
+// 負荷をSerial2へ約1秒毎に出力 (出力中は処理が止まるため計測時のみ使用)
+#define LOAD_REPORT 0
+
+// 受信フレームを記録し SYNTH_DUMP_TRACE でSerial2へ出力 (UART_MIDI使用時は出力不可)
+// 出力はオフラインレンダラの命令スクリプト形式
+#define I2C_TRACE 0
+
+// マルチティンバー (SYNTH_SET_PLAY_MODE で切り替え)
+// ディレイライン・ユーザー波形は arena から必要なパートにのみ割り当てる
+#define PART_COUNT 2
+#define VOICE_POOL 4 // 全パートで共有する発音数
+
+// 遅延線・ユーザー波形の領域 (全パートで共有, SYNTH_GET_MEMORY で使用量を取得)
+// 48kHzで2パートともディレイを使い、ユーザー波形3本まで (超えるパッチ・命令は拒否)
+#define ARENA_SIZE (128 * 1024)
+uint8_t arena_buffer[ARENA_SIZE] __attribute__((aligned(4)));
+SramArena arena(arena_buffer, ARENA_SIZE);
 
 // その他
-WaveGenerator wave(SAMPLE_RATE);
-int16_t buffer_L[BUFFER_SIZE]; // L側バッファ
-int16_t buffer_R[BUFFER_SIZE]; // R側バッファ
+WaveGenerator wave(SAMPLE_RATE);       // パート0
+WaveGenerator wave_part1(SAMPLE_RATE); // パート1
+WaveGenerator* parts[PART_COUNT] = {&wave, &wave_part1};
+uint32_t frame_buffer[BUFFER_SIZE]; // ステレオフレーム (I2Sへそのまま渡す)
+uint32_t part_buffer[BUFFER_SIZE];  // 2つ目以降のパートの生成先 (frame_bufferへ加算)
 
-bool isLed = false;   // LED点灯フラグ
-uint32_t* delay_long; // synth.h
-uint32_t remain = 0;  // ディレイの残りカウント用
+bool isLed = false;                // LED点灯フラグ
+uint32_t* delay_long[PART_COUNT];  // synth.h
+uint32_t remain[PART_COUNT] = {};  // ディレイの残りカウント用
 
-uint16_t buff_i = 0;       // ユーザー波形のバッファカウント用
-int16_t cshape_buff[2048]; // ユーザー波形のバッファ
+// シンセ命令のデコーダ
+CommandDecoder command(wave);
+CommandDecoder command_part1(wave_part1);
+CommandDecoder* decoders[PART_COUNT] = {&command, &command_part1};
+
+PartRouter router(PART_COUNT, VOICE_POOL); // ノートの送り先
 
 uint8_t response = 0x00; // レスポンスコード
+#define RESPONSE_SIZE 128
+uint8_t response_data[RESPONSE_SIZE]; // 複数バイトのレスポンス
+uint8_t response_size = 0;
+
+// ノートオン遅延計測
+LatencyHistogram latency;
+uint32_t note_arrival[128]; // 到着時刻(us) 0=計測なし
+uint8_t lat_count = 0;      // 計測待ちの数
+uint8_t lat_note[8];
+uint16_t lat_index[8];      // ブロック内の発音サンプル位置
+uint16_t lat_next = 0xffff; // 次に計測するサンプル位置
+
+// 処理負荷計測
+LoadMeter load0, load1;                // core0: generate(), core1: generate1()
+volatile uint32_t core1_busy_cycles = 0; // core1の処理時間の累計 (CPUサイクル)
+uint32_t core1_busy_prev = 0;
+uint32_t underruns = 0;                // I2Sアンダーラン回数
+uint32_t blocks = 0;                   // 生成したブロック数
+bool streaming = false;                // ブロックを連続出力中か
+VoiceGovernor governor;                // 負荷に応じた品質制御
+SynthStatus status;                    // SYNTH_GET_STATUS の集計
+
+size_t buffer_index = 0; // I2Sへ渡したサンプル数
+
+// サンプルクロック (起動からの出力サンプル数, 無音時は経過時間から換算)
+uint32_t sample_clock = 0;
+uint32_t idle_prev = 0;  // 無音時の経過時間計測用 (us)
+uint64_t idle_acc = 0;   // 換算の端数
+
+#if I2C_TRACE
+TraceBuffer trace;
+// 記録開始時のパラメータ (出力の先頭に書き出して再生時に復元する)
+Patch trace_patch[PART_COUNT];
+int16_t trace_table[PART_COUNT][2][2048]; // ユーザー波形
+bool trace_custom[PART_COUNT][2];
+#endif
+volatile uint8_t trace_request = 0x00; // 0x01: 出力, 0x02: 出力後にリセット
 
-void receiveEvent(int bytes) {
-    // 1バイト以上のみ受け付ける
-    if(bytes < 1) return;
+#define BATCH_SIZE 256
+uint8_t batch_buff[BATCH_SIZE];     // バッチフレームのバッファ
+int batch_bytes = 0;                // バッチフレームのサイズ
+volatile bool batch_pending = false; // 未適用のバッチがあるか
 
-    int i = 0;
-    uint8_t receivedData[bytes];
-    // 受信データをバッファに格納
-    while (i2c.available()) {
-        uint8_t received = i2c.read();
-        receivedData[i] = received;
-        i++;
-        if (i >= bytes) {
-            break;
+MidiParser midi;
+
+PresetStore presets;
+volatile uint8_t preset_request = 0x00; // 未処理のプリセット命令
+volatile uint8_t preset_slot = 0;
+
+// 演奏命令のサンプル単位の予約
+// 演奏中に受信したノート・CC・ピッチベンドは次のブロックの先頭で適用し、
+// SYNTH_SCHEDULE は1ブロック後を基準にして命令間の間隔をサンプル単位で保つ
+EventQueue events;
+uint32_t block_clock = 0; // 生成中のブロックの先頭のサンプルクロック
+
+volatile bool profile_pending = false; // 未処理のプロファイル切り替え
+volatile uint8_t profile_buffer = 3;
+volatile uint8_t profile_rate = 0;
+
+/**
+ * @brief 発音中のパートがあるか
+ */
+bool isPlaying() {
+    for(uint8_t p = 0; p < PART_COUNT; ++p) {
+        if(parts[p]->isGenerating()) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief パート毎の同時発音数の上限を反映します
+ * 使わないパートは発音を止める
+ */
+void applyPartLimits() {
+    for(uint8_t p = 0; p < PART_COUNT; ++p) {
+        if(p < router.getPartCount()) {
+            parts[p]->setNoteLimit(router.getPart(p).voices);
+        }
+        else {
+            parts[p]->noteReset();
         }
     }
+}
+
+/**
+ * @brief ボイスプールが埋まっている場合は他のパートのノートを止めます
+ * @param target 発音するパート
+ */
+void allocateVoice(uint8_t target) {
+    uint8_t used[PART_COUNT];
+    for(uint8_t p = 0; p < PART_COUNT; ++p) {
+        used[p] = parts[p]->getSoundingNote();
+    }
+    int8_t victim = router.pickVictim(used, target);
+    if(victim >= 0) parts[victim]->releaseOldest();
+}
 
+/**
+ * @brief 1命令分のデータを処理します
+ * シンセ命令は CommandDecoder、本体固有の命令はここで処理する
+ * ノート・CC・ピッチベンドはパートの割り当てに従って送り、それ以外は編集中のパートへ送る
+ * @param channel MIDIチャンネル 0~15 (I2C命令は PART_OMNI)
+ */
+void processCommand(const uint8_t* receivedData, int bytes, uint8_t channel = PART_OMNI) {
     // 命令コードを取得
     uint8_t instruction = receivedData[0];
 
@@ -71,273 +206,655 @@ void receiveEvent(int bytes) {
         case SYNTH_NOTE_ON:
             if(bytes < 3) return;
             {
-                uint8_t note = receivedData[1];
-                uint8_t velocity = receivedData[2];
-                wave.noteOn(note, velocity);
+                uint8_t mask = router.route(channel, receivedData[1]);
+                for(uint8_t p = 0; p < PART_COUNT; ++p) {
+                    if(!(mask & (1 << p))) continue;
+                    allocateVoice(p);
+                    decoders[p]->process(receivedData, bytes, &response);
+                }
             }
             break;
 
         // 例: {SYNTH_NOTE_OFF, <note>, <velocity>}
         case SYNTH_NOTE_OFF:
-            if(bytes < 3) return;
+            if(bytes < 2) return;
             {
-                uint8_t note = receivedData[1];
-                wave.noteOff(note);
+                uint8_t mask = router.route(channel, receivedData[1]);
+                for(uint8_t p = 0; p < PART_COUNT; ++p) {
+                    if(mask & (1 << p)) decoders[p]->process(receivedData, bytes, &response);
+                }
             }
             break;
 
-        // 例: {SYNTH_SET_SHAPE, <id>, <osc>}
-        case SYNTH_SET_SHAPE:
-            if(bytes < 3) return;
+        // 例: {SYNTH_CTRL_CHANGE, <cc>, <value>}
+        // 例: {SYNTH_PITCH_BEND, <lsb>, <msb>}
+        case SYNTH_CTRL_CHANGE:
+        case SYNTH_PITCH_BEND:
             {
-                wave.setShape(receivedData[1], receivedData[2]);
+                uint8_t mask = router.routeChannel(channel);
+                for(uint8_t p = 0; p < PART_COUNT; ++p) {
+                    if(mask & (1 << p)) decoders[p]->process(receivedData, bytes, &response);
+                }
             }
             break;
 
         // 例: {SYNTH_SOUND_STOP}
         case SYNTH_SOUND_STOP:
-            wave.noteReset();
-            break;
-
-        // 例: {SYNTH_SET_PAN, <pan>}
-        case SYNTH_SET_PAN:
-            if(bytes < 2) return;
-            wave.setAmpPan(receivedData[1]);
-            break;
-
-        // 例: {SYNTH_SET_ATTACK, <sec>, <msec>, <msec>, <msec>, <msec>}
-        case SYNTH_SET_ATTACK:
-        case SYNTH_SET_DECAY:
-        case SYNTH_SET_RELEASE:
-            if(bytes < 6) return;
-            {
-                int16_t data = 0;
-                data += receivedData[1] * 1000;
-                data += receivedData[2];
-                data += receivedData[3];
-                data += receivedData[4];
-                data += receivedData[5];
-                if(instruction == SYNTH_SET_ATTACK) {
-                    wave.setAttack(data);
-                }
-                else if(instruction == SYNTH_SET_DECAY) {
-                    wave.setDecay(data);
-                }
-                else if(instruction == SYNTH_SET_RELEASE) {
-                    wave.setRelease(data);
-                }
-            }
-            break;
-
-        // 例: {SYNTH_SET_SUSTAIN, <msec>, <msec>, <msec>, <msec>}
-        case SYNTH_SET_SUSTAIN:
-            if(bytes < 5) return;
-            {
-                int16_t sustain = 0;
-                sustain += receivedData[1];
-                sustain += receivedData[2];
-                sustain += receivedData[3];
-                sustain += receivedData[4];
-                wave.setSustain(sustain);
+            for(uint8_t p = 0; p < PART_COUNT; ++p) {
+                decoders[p]->process(receivedData, bytes, &response);
             }
             break;
 
         // 例: {SYNTH_GET_USED}
+        // 応答: 全パートの発音数の合計
         case SYNTH_GET_USED:
-            response = wave.getActiveNote();
+            {
+                uint8_t used = 0;
+                for(uint8_t p = 0; p < PART_COUNT; ++p) used += parts[p]->getActiveNote();
+                response = used;
+            }
             break;
 
         // 例: {SYNTH_IS_NOTE, <note>}
         case SYNTH_IS_NOTE:
-            if(wave.isNote(receivedData[1])) response = 0x01;
-            else response = 0x00;
+            if(bytes < 2) return;
+            response = 0x00;
+            for(uint8_t p = 0; p < PART_COUNT; ++p) {
+                if(parts[p]->isNote(receivedData[1])) response = 0x01;
+            }
             break;
 
-        // 例: {SYNTH_SET_CSHAPE, 0x01, 0x02, WAVE_DATA...}
-        case SYNTH_SET_CSHAPE:
-            if(bytes < 27) return;
+        // 例: {SYNTH_SET_PLAY_MODE, <SYNTH_POLY / SYNTH_MONO / SYNTH_DUAL / SYNTH_MULTI / SYNTH_LEGATO>}
+        // パートの割り当ては既定値に戻る
+        case SYNTH_SET_PLAY_MODE:
+            if(bytes < 2) return;
             {
-                for(uint16_t i = 0; i < 27; i++) {
-                    if(i < 3) continue;
-                    if(buff_i == 2048) {
-                        wave.setCustomShape(cshape_buff, receivedData[2]);
-                        buff_i = 0;
-                        break;
-                    }
-                    if(buff_i == 0) memset(cshape_buff, 0, 2048 * sizeof(int16_t));
-                    cshape_buff[buff_i] = static_cast<int16_t>((receivedData[i+1] << 8) | receivedData[i]);
-                    i++;
-                    buff_i++;
+                uint8_t mode = receivedData[1];
+                if(!router.setMode(mode)) {
+                    response = RES_ERROR;
+                    return;
+                }
+                if(mode == SYNTH_POLY || mode == SYNTH_MONO || mode == SYNTH_LEGATO) {
+                    wave.setMonophonic(mode != SYNTH_POLY, mode == SYNTH_LEGATO);
                 }
+                applyPartLimits();
+                response = RES_OK;
             }
             break;
 
-        // 例: {SYNTH_SET_VOICE, <voice>, <osc>}
-        case SYNTH_SET_VOICE:
-            if(bytes < 3) return;
+        // 例: {SYNTH_SET_PART, <part>, <channel(0~15, 0xFF:全て)>, <key_lo>, <key_hi>, <voices>}
+        case SYNTH_SET_PART:
+            if(bytes < 6) return;
             {
-                wave.setVoice(receivedData[1], receivedData[2]);
+                if(!router.setPart(receivedData[1], receivedData[2], receivedData[3], receivedData[4], receivedData[5])) {
+                    response = RES_ERROR;
+                    return;
+                }
+                applyPartLimits();
+                response = RES_OK;
             }
             break;
 
-        // 例: {SYNTH_SET_DETUNE, <detune>, <osc>}
-        case SYNTH_SET_DETUNE:
-            if(bytes < 3) return;
-            {
-                wave.setDetune(receivedData[1], receivedData[2]);
-            }
+        // 例: {SYNTH_EDIT_PART, <part>}
+        // 以降のパラメータ命令・プリセットの送り先
+        case SYNTH_EDIT_PART:
+            if(bytes < 2) return;
+            response = router.setEditPart(receivedData[1]) ? RES_OK : RES_ERROR;
             break;
 
-        // 例: {SYNTH_SET_SPREAD, <spread>, <osc>}
-        case SYNTH_SET_SPREAD:
-            if(bytes < 3) return;
+        // 例: {SYNTH_GET_LATENCY, <0x01(読み出し後リセット)>}
+        case SYNTH_GET_LATENCY:
             {
-                wave.setSpread(receivedData[1], receivedData[2]);
+                response_size = latency.serialize(response_data);
+                if(bytes >= 2 && receivedData[1] == 0x01) latency.reset();
             }
             break;
 
-        // 例: {SYNTH_SET_LPF, <bool>, 0x22...}
-        // 例: {SYNTH_SET_LPF, 0x00(false)}
-        case SYNTH_SET_LPF:
-            if(bytes < 2) return;
+        // 例: {SYNTH_GET_STATUS}
+        // 応答: SynthStatus::serialize() (空きボイス・各ノートの状態・負荷・入れ替え候補・予約の溢れ)
+        case SYNTH_GET_STATUS:
             {
-                if(receivedData[1] == 0x01){
-                    float freq, q;
-                    uint8_t d_freq[] = {receivedData[2], receivedData[3], receivedData[4], receivedData[5]};
-                    uint8_t d_q[] = {receivedData[6], receivedData[7], receivedData[8], receivedData[9]};
-                    memcpy(&freq, d_freq, sizeof(float));
-                    memcpy(&q, d_q, sizeof(float));
-                    wave.setLowPassFilter(true, freq, q);
-                } else {
-                    wave.setLowPassFilter(false);
+                status.begin(VOICE_POOL, load0.getLast(), load1.getLast(), governor.getLevel(), events.getDropped());
+                for(uint8_t p = 0; p < router.getPartCount(); ++p) {
+                    status.addPart(*parts[p], p);
                 }
+                response_size = status.serialize(response_data);
             }
             break;
 
-        // 例: {SYNTH_SET_HPF, <bool>, 0x22...}
-        // 例: {SYNTH_SET_HPF, 0x00(false)}
-        case SYNTH_SET_HPF:
-            if(bytes < 2) return;
-            {
-                if(receivedData[1] == 0x01){
-                    float freq, q;
-                    uint8_t d_freq[] = {receivedData[2], receivedData[3], receivedData[4], receivedData[5]};
-                    uint8_t d_q[] = {receivedData[6], receivedData[7], receivedData[8], receivedData[9]};
-                    memcpy(&freq, d_freq, sizeof(float));
-                    memcpy(&q, d_q, sizeof(float));
-                    wave.setHighPassFilter(true, freq, q);
-                } else {
-                    wave.setHighPassFilter(false);
-                }
-            }
+        // 例: {SYNTH_GET_MEMORY}
+        // 応答: SramArena::serialize() (容量・使用量・ピーク・最大の空き・ディレイ・ユーザー波形, 領域数・拒否数)
+        case SYNTH_GET_MEMORY:
+            response_size = arena.serialize(response_data);
             break;
 
-        // 例: {SYNTH_SET_OSC_LVL, <OSC>, <HB_Level>, <LB_Level>}
-        case SYNTH_SET_OSC_LVL:
-            if(bytes < 4) return;
+        // 例: {SYNTH_GET_LOAD, <0x01(読み出し後リセット)>}
+        // 応答: {core0_avg, core0_peak, core1_avg, core1_peak (u16 千分率), underruns, blocks (u32),
+        //        governor_level (u8), escalations, steals, unison_reduced, sub_skipped (u32)}
+        case SYNTH_GET_LOAD:
             {
-                wave.setOscLevel(receivedData[1], (receivedData[2] << 8) | receivedData[3]);
+                uint16_t values[4] = {load0.getAverage(), load0.getPeak(), load1.getAverage(), load1.getPeak()};
+                uint8_t n = 0;
+                for(uint8_t v = 0; v < 4; ++v) {
+                    response_data[n++] = values[v] & 0xFF;
+                    response_data[n++] = values[v] >> 8;
+                }
+                for(uint8_t b = 0; b < 4; ++b) response_data[n++] = (underruns >> (b * 8)) & 0xFF;
+                for(uint8_t b = 0; b < 4; ++b) response_data[n++] = (blocks >> (b * 8)) & 0xFF;
+
+                uint32_t counts[4] = {governor.getEscalations(), 0, 0, 0};
+                for(uint8_t p = 0; p < PART_COUNT; ++p) {
+                    uint32_t part_counts[3];
+                    parts[p]->getGovernorCounts(part_counts);
+                    for(uint8_t c = 0; c < 3; ++c) counts[c + 1] += part_counts[c];
+                }
+                response_data[n++] = governor.getLevel();
+                for(uint8_t c = 0; c < 4; ++c) {
+                    for(uint8_t b = 0; b < 4; ++b) response_data[n++] = (counts[c] >> (b * 8)) & 0xFF;
+                }
+                response_size = n;
+
+                if(bytes >= 2 && receivedData[1] == 0x01) {
+                    load0.reset();
+                    load1.reset();
+                    underruns = 0;
+                    blocks = 0;
+                    governor.resetCount();
+                    for(uint8_t p = 0; p < PART_COUNT; ++p) parts[p]->resetGovernorCounts();
+                }
             }
             break;
 
-        // 例: {SYNTH_SET_OCT, <osc>, <octave>}
-        case SYNTH_SET_OCT:
-            if(bytes < 3) return;
+        // 例: {SYNTH_DUMP_TRACE, <0x01(出力後リセット)>}
+        case SYNTH_DUMP_TRACE:
             {
-                wave.setOscOctave(receivedData[1], static_cast<int8_t>(receivedData[2]));
+#if I2C_TRACE && !UART_MIDI
+                trace_request = (bytes >= 2 && receivedData[1] == 0x01) ? 0x02 : 0x01;
+                response = RES_OK;
+#else
+                response = RES_ERROR;
+#endif
             }
             break;
 
-        // 例: {SYNTH_SET_SEMI, <osc>, <semitone>}
-        case SYNTH_SET_SEMI:
-            if(bytes < 3) return;
+        // 例: {SYNTH_SAVE_PRESET, <slot>}
+        // 例: {SYNTH_LOAD_PRESET, <slot>}
+        case SYNTH_SAVE_PRESET:
+        case SYNTH_LOAD_PRESET:
+            if(bytes < 2) return;
             {
-                wave.setOscSemitone(receivedData[1], static_cast<int8_t>(receivedData[2]));
+                if(!presets.isValidSlot(receivedData[1]) || preset_request != 0x00) {
+                    response = RES_ERROR;
+                    return;
+                }
+                preset_slot = receivedData[1];
+                preset_request = instruction;
             }
             break;
 
-        // 例: {SYNTH_SET_CENT, <osc>, <cent>}
-        case SYNTH_SET_CENT:
+        // 例: {SYNTH_SET_PROFILE, <buffer(0:32, 1:64, 2:128, 3:256)>, <rate(0:48kHz, 1:44.1kHz)>}
+        case SYNTH_SET_PROFILE:
             if(bytes < 3) return;
             {
-                wave.setOscCent(receivedData[1], static_cast<int8_t>(receivedData[2]));
+                if(receivedData[1] > 3 || receivedData[2] > 1 || profile_pending) {
+                    response = RES_ERROR;
+                    return;
+                }
+                profile_buffer = receivedData[1];
+                profile_rate = receivedData[2];
+                profile_pending = true;
             }
             break;
 
-        // 例: {SYNTH_SET_LEVEL, <HB_level>, <LB_level>}
-        case SYNTH_SET_LEVEL:
-            if(bytes < 3) return;
-            {
-                wave.setAmpLevel((receivedData[1] << 8) | receivedData[2]);
-            }
+        default:
+            decoders[router.getEditPart()]->process(receivedData, bytes, &response);
             break;
+    }
+}
 
-        // 例: {SYNTH_SET_DELAY, <true|false>, <HB_time>, <LB_time>, <HB_level>, <LB_level>, <HB_feedback>, <LB_feedback>}
-        case SYNTH_SET_DELAY:
-            if(bytes < 8) return;
-            {
-                if(receivedData[1] == 0x01) {
-                    int16_t time = static_cast<int16_t>((receivedData[2] << 8) | receivedData[3]);
-                    int16_t level = static_cast<int16_t>((receivedData[4] << 8) | receivedData[5]);
-                    int16_t feedback = static_cast<int16_t>((receivedData[6] << 8) | receivedData[7]);
-                    wave.setDelay(true, time, level, feedback);
-                }
-                else {
-                    wave.setDelay(false);
-                }
-            }
-            break;
+/**
+ * @brief バッチフレームをまとめて適用します
+ * 派生値の計算は最後に一度だけ行われます
+ */
+void applyBatch() {
+    for(uint8_t p = 0; p < PART_COUNT; ++p) parts[p]->beginUpdate();
 
-        // 例: {SYNTH_SET_MOD, <mod>}
-        case SYNTH_SET_MOD:
-            if(bytes < 2) return;
-            {
-                wave.setMod(receivedData[1]);
+    int i = 1;
+    while(i < batch_bytes) {
+        uint8_t size = batch_buff[i];
+        i++;
+        if(size < 1 || i + size > batch_bytes) break;
+        if(batch_buff[i] != SYNTH_SET_BATCH) {
+            if(batch_buff[i] == SYNTH_NOTE_ON && size >= 2 && batch_buff[i + 1] < 128) {
+                note_arrival[batch_buff[i + 1]] = micros() | 1;
             }
-            break;
+            processCommand(&batch_buff[i], size);
+        }
+        i += size;
+    }
 
-        // 例: {SYNTH_SET_MONO, <true|false>}
-        case SYNTH_SET_MONO:
-            if(bytes < 2) return;
-            {
-                if(receivedData[1] == 0x01) wave.setMonophonic(true);
-                else wave.setMonophonic(false);
-            }
-            break;
+    for(uint8_t p = 0; p < PART_COUNT; ++p) parts[p]->endUpdate();
+    batch_pending = false;
+}
 
-        // 例: {SYNTH_SET_GLIDE, <true|false>, <HB_time>, <LB_time>}
-        case SYNTH_SET_GLIDE:
-            if(bytes < 2) return;
-            {
-                if(receivedData[1] == 0x01) {
-                    if(bytes >= 4) {
-                        uint16_t time = static_cast<uint16_t>((receivedData[2] << 8) | receivedData[3]);
-                        wave.setGlideMode(true, time);
-                    }
-                    else wave.setGlideMode(true);
-                }
-                else {
-                    wave.setGlideMode(false);
-                }
-            }
-            break;
+/**
+ * @brief プリセットの保存・読み出しを行います
+ * 対象は編集中のパート
+ */
+void applyPreset() {
+    bool result;
+    WaveGenerator& part = *parts[router.getEditPart()];
+    if(preset_request == SYNTH_SAVE_PRESET) {
+        result = presets.save(preset_slot, part);
+    }
+    else {
+        // 遅延線・ユーザー波形の割り当てをI2C割り込みと競合させない
+        noInterrupts();
+        result = presets.load(preset_slot, part);
+        interrupts();
+    }
+    response = result ? RES_OK : RES_ERROR;
+    preset_request = 0x00;
+}
 
-        // 例: {SYNTH_RESET_PARAM}
-        case SYNTH_RESET_PARAM:
-            if(bytes < 1) return;
-            {
-                wave.resetParam();
+/**
+ * @brief バッファサイズとサンプリング周波数を切り替えます
+ * サンプリング周波数が変わる場合は発音中のノートとディレイの残響を止める
+ */
+void applyProfile() {
+    uint32_t rate = PROFILE_RATE[profile_rate];
+    if(rate != sample_rate) {
+        sample_rate = rate;
+        for(uint8_t p = 0; p < PART_COUNT; ++p) {
+            parts[p]->setSampleRate(sample_rate);
+            remain[p] = 0;
+        }
+        i2s.setFrequency(sample_rate);
+    }
+    buffer_size = PROFILE_BUFFER[profile_buffer];
+    buffer_index = buffer_size;
+
+    // 締め切りはブロックの長さ
+    uint32_t deadline = (uint32_t)buffer_size * 1000000 / sample_rate;
+    load0.setDeadline(deadline);
+    load1.setDeadline(deadline);
+    load0.reset();
+    load1.reset();
+
+    response = RES_OK;
+    profile_pending = false;
+}
+
+/**
+ * @brief 演奏命令を適用するサンプル位置を取得します
+ * 演奏中は生成中のブロックの次のブロックの先頭 (無音時は直ちに)
+ * @param scheduled SYNTH_SCHEDULE の遅延の基準にする場合 true
+ *                  (さらに1ブロック後を基準にし、生成済みの分に関わらず指定した間隔を保つ)
+ */
+uint32_t scheduleClock(bool scheduled = false) {
+    if(!streaming) return sample_clock;
+    return sample_clock + (scheduled ? buffer_size : buffer_size - buffer_index);
+}
+
+/**
+ * @brief 受信した命令を処理します
+ * 演奏命令はサンプル位置を付けて予約し、それ以外は直ちに処理する
+ * @param channel MIDIチャンネル 0~15 (I2C命令は PART_OMNI)
+ * @param scheduled SYNTH_SCHEDULE で受信した場合 true
+ * @param delay 追加の遅延 (サンプル, SYNTH_SCHEDULE)
+ */
+void receiveCommand(const uint8_t* data, int bytes, uint8_t channel = PART_OMNI, bool scheduled = false, uint32_t delay = 0) {
+    if(EventQueue::isTimed(data[0])) {
+        // 遅延計測用に到着時刻を記録
+        if(data[0] == SYNTH_NOTE_ON && bytes >= 2 && data[1] < 128) note_arrival[data[1]] = micros() | 1;
+
+        uint32_t at = scheduleClock(scheduled) + delay;
+        if(events.push(at, data, bytes, channel)) return;
+    }
+    processCommand(data, bytes, channel);
+}
+
+/**
+ * @brief 指定したサンプルクロックまでに予約された命令を適用します
+ */
+void dispatchEvents(uint32_t clock) {
+    noInterrupts();
+    const EventQueue::Event* e;
+    while((e = events.peek()) != nullptr && (int32_t)(e->sample - clock) <= 0) {
+        processCommand(e->data, e->size, e->channel);
+        events.pop();
+    }
+    interrupts();
+}
+
+/**
+ * @brief 受信フレームを記録します
+ * 演奏命令は実際に適用するサンプル位置で記録する
+ * (SYNTH_SCHEDULE の遅延はレンダラが加えるため含めない)
+ */
+void traceFrame(const uint8_t* data, int size) {
+#if I2C_TRACE
+    bool scheduled = (data[0] == SYNTH_SCHEDULE && size >= 4);
+    const uint8_t* command = scheduled ? &data[3] : data;
+    trace.record(EventQueue::isTimed(command[0]) ? scheduleClock(scheduled) : sample_clock, data, size);
+#endif
+}
+
+/**
+ * @brief 記録開始時のパラメータを保存します
+ * 起動時と記録のリセット時に呼び、記録とまとめて切り替えるため割り込みを止める
+ */
+void traceSnapshot() {
+#if I2C_TRACE
+    noInterrupts();
+    trace.clear();
+    for(uint8_t p = 0; p < PART_COUNT; ++p) {
+        trace_patch[p] = parts[p]->getPatch();
+        for(uint8_t osc = 0x01; osc <= 0x02; ++osc) {
+            const int16_t* table = parts[p]->getCustomShape(osc);
+            trace_custom[p][osc - 1] = table != nullptr;
+            if(table != nullptr) memcpy(trace_table[p][osc - 1], table, sizeof(trace_table[p][osc - 1]));
+        }
+    }
+    interrupts();
+#endif
+}
+
+#if I2C_TRACE && !UART_MIDI
+void printTraceBytes(const uint8_t* data, uint16_t size) {
+    for(uint16_t i = 0; i < size; ++i) {
+        Serial2.print(data[i] < 0x10 ? " 0x0" : " 0x");
+        Serial2.print(data[i], HEX);
+    }
+    Serial2.println();
+}
+#endif
+
+/**
+ * @brief 記録したフレームをSerial2へ出力します
+ * 出力中は音声が途切れるため解析時のみ使用する
+ * 先頭に記録開始時のパラメータ (!patch <part>) とユーザー波形 (!cshape <part> <osc>) を
+ * バイト列で出力し、レンダラはこれを適用してからフレームを再生する
+ * 例: @123456 0xBE 0x3C 0x64
+ */
+void dumpTrace() {
+#if I2C_TRACE && !UART_MIDI
+    trace.pause(true);
+    Serial2.print("# trace rate=");
+    Serial2.print(sample_rate);
+    Serial2.print(" frames=");
+    Serial2.print(trace.getCount());
+    Serial2.print(" overwritten=");
+    Serial2.println(trace.getOverwritten());
+
+    for(uint8_t p = 0; p < PART_COUNT; ++p) {
+        Serial2.print("!patch ");
+        Serial2.print(p);
+        printTraceBytes((const uint8_t*)&trace_patch[p], sizeof(Patch));
+        for(uint8_t osc = 0x01; osc <= 0x02; ++osc) {
+            if(!trace_custom[p][osc - 1]) continue;
+            Serial2.print("!cshape ");
+            Serial2.print(p);
+            Serial2.print(" ");
+            Serial2.print(osc);
+            printTraceBytes((const uint8_t*)trace_table[p][osc - 1], sizeof(trace_table[p][osc - 1]));
+        }
+    }
+
+    for(uint16_t n = 0; n < trace.getCount(); ++n) {
+        const TraceBuffer::Frame* f = trace.get(n);
+        uint16_t size = f->size < TRACE_FRAME_MAX ? f->size : TRACE_FRAME_MAX;
+        // 途中までしか記録していないフレームは再生しない
+        if(f->size > TRACE_FRAME_MAX) Serial2.print("# truncated ");
+        Serial2.print("@");
+        Serial2.print(f->sample);
+        for(uint16_t i = 0; i < size; ++i) {
+            uint8_t b = trace.getData(f, i);
+            Serial2.print(b < 0x10 ? " 0x0" : " 0x");
+            Serial2.print(b, HEX);
+        }
+        Serial2.println();
+    }
+
+    if(trace_request == 0x02) traceSnapshot();
+    trace.pause(false);
+#endif
+    trace_request = 0x00;
+}
+
+/**
+ * @brief 無音時のサンプルクロックを経過時間から進めます
+ */
+void advanceIdleClock() {
+    uint32_t now = micros();
+    idle_acc += (uint64_t)(now - idle_prev) * sample_rate;
+    idle_prev = now;
+    sample_clock += idle_acc / 1000000;
+    idle_acc %= 1000000;
+}
+
+/**
+ * @brief UARTのMIDI入力を処理します
+ * I2Cと同じ命令経路で処理する
+ */
+void pollMidi() {
+#if UART_MIDI
+    uint8_t midi_command[3];
+    while(Serial2.available()) {
+        uint8_t size = midi.parse(Serial2.read(), midi_command);
+        if(size > 0) {
+            // I2C割り込みとの競合を防ぐ
+            noInterrupts();
+            traceFrame(midi_command, size);
+            receiveCommand(midi_command, size, midi.getChannel());
+            interrupts();
+        }
+    }
+#endif
+}
+
+/**
+ * @brief 出力したサンプル位置の遅延を記録します
+ */
+void recordLatency() {
+    uint32_t now = micros();
+    uint16_t next = 0xffff;
+    for(uint8_t n = 0; n < lat_count; ++n) {
+        if(lat_index[n] == 0xffff) continue;
+        if(lat_index[n] < buffer_index) {
+            uint32_t arrival = note_arrival[lat_note[n]];
+            if(arrival != 0) {
+                latency.add(now - arrival);
+                note_arrival[lat_note[n]] = 0;
             }
+            lat_index[n] = 0xffff;
+        }
+        else if(lat_index[n] < next) {
+            next = lat_index[n];
+        }
+    }
+    lat_next = next;
+}
+
+static inline int16_t clip16(int32_t v) {
+    if(v > INT16_MAX) return INT16_MAX;
+    if(v < INT16_MIN) return INT16_MIN;
+    return v;
+}
+
+/**
+ * @brief フレームを加算します (飽和)
+ */
+void mixFrames(uint32_t* dst, const uint32_t* src, size_t size) {
+    for(size_t i = 0; i < size; ++i) {
+        dst[i] = FRAME_PACK(clip16(FRAME_L(dst[i]) + FRAME_L(src[i])), clip16(FRAME_R(dst[i]) + FRAME_R(src[i])));
+    }
+}
+
+/**
+ * @brief ブロックの一部を生成します
+ * 発音中のパートを順に生成してミックスし、発音を終えたパートはディレイの残響のみ生成する
+ * 発音も残響も無いパートは処理しない
+ */
+void renderSpan(size_t offset, size_t size) {
+    bool first = true;
+    for(uint8_t p = 0; p < PART_COUNT; ++p) {
+        WaveGenerator* part = parts[p];
+        uint32_t* dst = first ? frame_buffer : part_buffer;
+
+        if(part->isGenerating()) {
+            remain[p] = *delay_long[p];
+            part->generateSpan(dst, offset, size);
+        }
+        else if(part->isDelayEnabled() && remain[p] > 0) {
+            part->generateTail(&dst[offset], size);
+            remain[p] = remain[p] > size ? remain[p] - size : 0;
+        }
+        else {
+            continue;
+        }
+
+        if(!first) mixFrames(&frame_buffer[offset], &part_buffer[offset], size);
+        first = false;
+    }
+    if(first) memset(&frame_buffer[offset], 0, size * sizeof(uint32_t));
+}
+
+/**
+ * @brief 無効にしたディレイの遅延線を返します (ブロック境界で呼ぶ)
+ */
+void releasePending() {
+    noInterrupts();
+    for(uint8_t p = 0; p < PART_COUNT; ++p) parts[p]->releasePending();
+    interrupts();
+}
+
+/**
+ * @brief 1ブロック分を生成します
+ * 予約された演奏命令の位置でブロックを区切り、命令をそのサンプルから適用する
+ */
+void renderBlock() {
+    releasePending();
+    block_clock = sample_clock;
+    for(uint8_t p = 0; p < PART_COUNT; ++p) parts[p]->beginBlock();
+
+    size_t offset = 0;
+    while(offset < buffer_size) {
+        dispatchEvents(block_clock + offset);
+
+        // 次の命令の位置まで生成
+        size_t end = buffer_size;
+        noInterrupts();
+        const EventQueue::Event* e = events.peek();
+        if(e != nullptr && e->sample - block_clock < buffer_size) end = e->sample - block_clock;
+        interrupts();
+
+        renderSpan(offset, end - offset);
+        offset = end;
+    }
+
+    // 遅延計測対象の取得
+    lat_count = 0;
+    for(uint8_t p = 0; p < PART_COUNT; ++p) {
+        parts[p]->endBlock(buffer_size);
+        lat_count += parts[p]->getStartedNotes(&lat_note[lat_count], &lat_index[lat_count], 8 - lat_count);
+    }
+}
+
+/**
+ * @brief 1ブロック分の負荷を記録します
+ */
+void recordLoad(uint32_t busy0_us) {
+    load0.add(busy0_us);
+
+    uint32_t busy1 = core1_busy_cycles;
+    load1.add((uint64_t)(busy1 - core1_busy_prev) * 1000000 / rp2040.f_cpu());
+    core1_busy_prev = busy1;
+
+    // 出力開始直後は無音区間のアンダーランを無視
+    if(i2s.getUnderflow() && streaming) underruns++;
+    streaming = true;
+    blocks++;
+
+    // 締め切りに近づいたら次のブロックから品質を落とす
+    uint8_t level = governor.update(load0.getLast(), buffer_size);
+    for(uint8_t p = 0; p < PART_COUNT; ++p) parts[p]->setGovernorLevel(level);
+
+#if LOAD_REPORT && !UART_MIDI
+    if(blocks % (sample_rate / buffer_size) == 0) {
+        Serial2.print("load0 ");
+        Serial2.print(load0.getAverage());
+        Serial2.print("/");
+        Serial2.print(load0.getPeak());
+        Serial2.print(" load1 ");
+        Serial2.print(load1.getAverage());
+        Serial2.print("/");
+        Serial2.print(load1.getPeak());
+        Serial2.print(" underrun ");
+        Serial2.print(underruns);
+        Serial2.print(" gov ");
+        Serial2.println(governor.getLevel());
+    }
+#endif
+}
+
+void receiveEvent(int bytes) {
+    // 1バイト以上のみ受け付ける
+    if(bytes < 1) return;
+
+    int i = 0;
+    uint8_t receivedData[bytes];
+    // 受信データをバッファに格納
+    while (i2c.available()) {
+        uint8_t received = i2c.read();
+        receivedData[i] = received;
+        i++;
+        if (i >= bytes) {
             break;
+        }
     }
+
+    traceFrame(receivedData, bytes);
+
+    // 例: {SYNTH_SET_BATCH, <size>, <命令...>, <size>, <命令...>, ...}
+    // 次のブロック境界でまとめて適用する
+    if(receivedData[0] == SYNTH_SET_BATCH) {
+        if(batch_pending || bytes > BATCH_SIZE) {
+            response = RES_ERROR;
+            return;
+        }
+        memcpy(batch_buff, receivedData, bytes);
+        batch_bytes = bytes;
+        batch_pending = true;
+        response = RES_OK;
+        return;
+    }
+
+    // 例: {SYNTH_SCHEDULE, <delay LB>, <delay HB>, <命令...>}
+    // 演奏命令を受信位置からさらに delay サンプル後に適用する
+    if(receivedData[0] == SYNTH_SCHEDULE) {
+        if(bytes < 4) return;
+        receiveCommand(&receivedData[3], bytes - 3, PART_OMNI, true, receivedData[1] | (receivedData[2] << 8));
+        return;
+    }
+
+    receiveCommand(receivedData, bytes);
 }
 
 void requestEvent() {
-    i2c.write(response);
+    if(response_size > 0) {
+        i2c.write(response_data, response_size);
+        response_size = 0;
+    }
+    else {
+        i2c.write(response);
+    }
     response = 0x00;
 }
 
 void setup() {
+    for(uint8_t p = 0; p < PART_COUNT; ++p) parts[p]->setArena(&arena, p);
+
     i2c.setSDA(SDA_PIN);
     i2c.setSCL(SCL_PIN);
     i2c.begin(I2C_ADDR);
@@ -345,19 +862,29 @@ void setup() {
     i2c.onReceive(receiveEvent);
     i2c.onRequest(requestEvent);
 
-    // DebugPin
+    // DebugPin / MIDI IN
     Serial2.setTX(8);
     Serial2.setRX(9);
+#if UART_MIDI
+    Serial2.begin(31250);
+    midi.setChannel(UART_MIDI_CHANNEL);
+#else
     Serial2.begin(115200);
+#endif
 
     i2s.setBCLK(PIN_I2S_BCLK);
     i2s.setDATA(PIN_I2S_DOUT);
     i2s.setBitsPerSample(SAMPLE_BITS);
-    i2s.begin(SAMPLE_RATE);
+    i2s.begin(sample_rate);
 
     pinMode(LED_BUILTIN, OUTPUT);
 
-    delay_long = wave.getDelayLong();
+    for(uint8_t p = 0; p < PART_COUNT; ++p) delay_long[p] = parts[p]->getDelayLong();
+    traceSnapshot();
+
+    uint32_t deadline = (uint32_t)buffer_size * 1000000 / sample_rate;
+    load0.setDeadline(deadline);
+    load1.setDeadline(deadline);
 }
 
 /**
@@ -366,39 +893,64 @@ void setup() {
  */
 void loop() {
     while (1) {
-        if (wave.getActiveNote() != 0) {
-            static size_t buffer_index = 0;
+        // バッチ・プリセットはブロック境界で適用
+        if (buffer_index == buffer_size || !isPlaying()) {
+            if (profile_pending) applyProfile();
+            if (batch_pending) applyBatch();
+            if (preset_request != 0x00) applyPreset();
+            if (trace_request != 0x00) dumpTrace();
+        }
 
+        if (isPlaying()) {
             isLed = true;
-            remain = *delay_long;
-            if (buffer_index == BUFFER_SIZE) {
-                // /*debug*/ unsigned long startTime = micros();
-                wave.generate(buffer_L, buffer_R, BUFFER_SIZE); // 目標: 5ミリ秒以内に完了する
-                // /*debug*/ unsigned long endTime = micros();
-                // /*debug*/ unsigned long duration = endTime - startTime;
-                // /*debug*/ Serial2.print(" ");
-                // /*debug*/ Serial2.print(duration);
-                // /*debug*/ Serial2.println("us");
+            if (buffer_index == buffer_size) {
+                uint32_t start = micros();
+                renderBlock(); // 目標: ブロックの長さ以内に完了する
+                recordLoad(micros() - start);
                 buffer_index = 0;
+
+                lat_next = 0xffff;
+                for(uint8_t n = 0; n < lat_count; ++n) {
+                    if(lat_index[n] < lat_next) lat_next = lat_index[n];
+                }
             }
 
-            while (buffer_index < BUFFER_SIZE) {
-                i2s.write(buffer_L[buffer_index]);  // L
-                i2s.write(buffer_R[buffer_index]);  // R
-                buffer_index++;
+            // DMAバッファの空きへまとめて渡す (ブロックしない)
+            while (buffer_index < buffer_size) {
+                size_t written = i2s.write((const uint8_t*)&frame_buffer[buffer_index], (buffer_size - buffer_index) * sizeof(uint32_t));
+                written /= sizeof(uint32_t);
+                buffer_index += written;
+                sample_clock += written;
+                if(lat_next < buffer_index) recordLatency();
+                pollMidi();
             }
+            idle_prev = micros();
 
         } else {
+            pollMidi();
+            dispatchEvents(sample_clock);
+            releasePending();
+
             // ディレイが残っている場合の処理
-            if(wave.isDelayEnabled() && remain > 0) {
-                int16_t remain_L = wave.delayProcess(0, 0x00);
-                int16_t remain_R = wave.delayProcess(0, 0x01);
-                i2s.write(remain_L); // L
-                i2s.write(remain_R); // R
-                remain--;
+            bool tail = false;
+            int32_t remain_L = 0;
+            int32_t remain_R = 0;
+            for(uint8_t p = 0; p < PART_COUNT; ++p) {
+                if(!parts[p]->isDelayEnabled() || remain[p] == 0) continue;
+                remain_L += parts[p]->delayProcess(0, 0x00);
+                remain_R += parts[p]->delayProcess(0, 0x01);
+                remain[p]--;
+                tail = true;
+            }
+            if(tail) {
+                i2s.write16(clip16(remain_L), clip16(remain_R));
+                sample_clock++;
+                idle_prev = micros();
             } else {
                 isLed = false;
+                advanceIdleClock();
             }
+            streaming = false;
         }
     }
 }
@@ -414,6 +966,12 @@ void loop1() {
         } else {
             gpio_put(LED_BUILTIN, LOW);
         }
-        wave.generate1(); // 分散処理用関数
+        // 処理待ちのパートだけ計測する (サンプル毎に呼ばれるためサイクルカウンタで計測)
+        for(uint8_t p = 0; p < PART_COUNT; ++p) {
+            if(!parts[p]->isCore1Pending()) continue;
+            uint32_t start = rp2040.getCycleCount();
+            parts[p]->generate1(); // 分散処理用関数
+            core1_busy_cycles += rp2040.getCycleCount() - start;
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,134 @@
+#ifndef MIDIPARSER_H
+#define MIDIPARSER_H
+
+#include <instruction_set.h>
+
+#define MIDI_OMNI 0xFF
+
+#define MIDI_CC_ALL_SOUND_OFF 120
+
+/// MIDI 1.0 バイトストリームのパーサ
+///
+/// ランニングステータス、リアルタイムメッセージ(0xF8~0xFF)の割り込み、
+/// システムエクスクルーシブの読み飛ばしに対応する。
+/// 完成したメッセージは instruction_set.h の命令列に変換され、
+/// I2Cで受信した命令と同じ経路で処理できる。
+class MidiParser {
+private:
+    uint8_t channel = MIDI_OMNI; // 受信チャンネル 0~15
+    uint8_t status = 0x00;       // ランニングステータス
+    uint8_t last_channel = 0;    // 最後に変換したメッセージのチャンネル
+    uint8_t data[2];
+    uint8_t count = 0;
+    bool sysex = false;
+
+    uint8_t dataLength(uint8_t st) {
+        switch(st & 0xF0) {
+            case 0xC0:
+            case 0xD0:
+                return 1;
+            default:
+                return 2;
+        }
+    }
+
+    // 命令列へ変換 (対応しないメッセージは0)
+    uint8_t convert(uint8_t* out) {
+        if(channel != MIDI_OMNI && (status & 0x0F) != channel) return 0;
+        last_channel = status & 0x0F;
+
+        switch(status & 0xF0) {
+            case 0x80:
+                out[0] = SYNTH_NOTE_OFF;
+                out[1] = data[0];
+                out[2] = data[1];
+                return 3;
+
+            case 0x90:
+                out[0] = data[1] == 0 ? SYNTH_NOTE_OFF : SYNTH_NOTE_ON;
+                out[1] = data[0];
+                out[2] = data[1];
+                return 3;
+
+            case 0xB0:
+                // All Notes Off はCCのまま送りリリースさせる (WaveGenerator::controlChange)
+                if(data[0] == MIDI_CC_ALL_SOUND_OFF) {
+                    out[0] = SYNTH_SOUND_STOP;
+                    return 1;
+                }
+                out[0] = SYNTH_CTRL_CHANGE;
+                out[1] = data[0];
+                out[2] = data[1];
+                return 3;
+
+            case 0xE0:
+                out[0] = SYNTH_PITCH_BEND;
+                out[1] = data[0]; // LSB
+                out[2] = data[1]; // MSB
+                return 3;
+        }
+        return 0;
+    }
+
+public:
+    /**
+     * @brief 受信チャンネルを設定します
+     * @param ch 0~15 または MIDI_OMNI
+     */
+    void setChannel(uint8_t ch) {
+        channel = (ch < 16) ? ch : MIDI_OMNI;
+    }
+
+    // 最後に変換したメッセージのチャンネル (マルチティンバーの振り分け用)
+    uint8_t getChannel() {
+        return last_channel;
+    }
+
+    void reset() {
+        status = 0x00;
+        count = 0;
+        sysex = false;
+    }
+
+    /**
+     * @brief 1バイトを処理します
+     * @param out 命令列の出力先 (3バイト以上)
+     * @return 命令列のバイト数 (メッセージ未完成なら0)
+     */
+    uint8_t parse(uint8_t byte, uint8_t* out) {
+        // リアルタイムメッセージはどこにでも割り込める
+        if(byte >= 0xF8) return 0;
+
+        if(byte & 0x80) {
+            if(byte == 0xF0) {
+                sysex = true;
+                status = 0x00;
+            }
+            else if(byte == 0xF7) {
+                sysex = false;
+            }
+            else if(byte >= 0xF1) {
+                // システムコモンはランニングステータスを解除
+                sysex = false;
+                status = 0x00;
+            }
+            else {
+                sysex = false;
+                status = byte;
+            }
+            count = 0;
+            return 0;
+        }
+
+        // データバイト
+        if(sysex || status == 0x00) return 0;
+
+        data[count++] = byte;
+        if(count < dataLength(status)) return 0;
+        count = 0;
+
+        return convert(out);
+    }
+};
+
+#endif // MIDIPARSER_H
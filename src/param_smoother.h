@@ -0,0 +1,43 @@
+#ifndef PARAMSMOOTHER_H
+#define PARAMSMOOTHER_H
+
+/// パラメータの平滑化 (1次IIR)
+/// コントロールレートで next() を呼び、目標値へ指数的に近づける
+class ParamSmoother {
+private:
+    int32_t current; // 内部精度 <<8
+    int32_t target;  // 内部精度 <<8
+    uint8_t shift;   // 係数 1/2^shift
+
+public:
+    ParamSmoother(int32_t value = 0, uint8_t shift = 3): shift(shift) {
+        set(value);
+    }
+
+    // 目標値を設定 (次のnext()から追従)
+    void setTarget(int32_t value) {
+        target = value << 8;
+    }
+
+    // 即時に値を設定
+    void set(int32_t value) {
+        current = target = value << 8;
+    }
+
+    bool isSettled() {
+        return current == target;
+    }
+
+    int32_t get() {
+        return current >> 8;
+    }
+
+    int32_t next() {
+        int32_t step = (target - current) >> shift;
+        if(step == 0) current = target;
+        else current += step;
+        return current >> 8;
+    }
+};
+
+#endif // PARAMSMOOTHER_H
@@ -0,0 +1,179 @@
+#ifndef PARTROUTER_H
+#define PARTROUTER_H
+
+#include <instruction_set.h>
+
+#define MAX_PARTS  4    // パート設定の数
+#define PART_OMNI  0xFF // 全チャンネルを受信
+
+/// マルチティンバー (SYNTH_DUAL / SYNTH_MULTI) のパート割り当て
+///
+/// 各パートは MIDI チャンネル・キー範囲・同時発音数の上限を持つ。
+/// ノートはチャンネルとキー範囲が一致した全てのパートへ送られる (重ねる場合は範囲を重複させる)。
+/// 全パートで共有する発音数 (ボイスプール) を超えた場合は、
+/// 上限に対して最も多く発音しているパートから停止させる。
+class PartRouter {
+public:
+    struct Part {
+        uint8_t channel; // 0~15 または PART_OMNI
+        uint8_t key_lo;  // キー範囲
+        uint8_t key_hi;
+        uint8_t voices;  // 同時発音数の上限
+    };
+
+private:
+    Part parts[MAX_PARTS];
+    uint8_t mode = SYNTH_POLY;
+    uint8_t part_count = 1; // 有効なパート数
+    uint8_t part_max;       // 本体で使えるパート数
+    uint8_t pool;           // 全パートで共有する発音数
+    uint8_t edit = 0;       // パラメータ命令の送り先
+
+public:
+    /**
+     * @param available 本体で使えるパート数
+     * @param voice_pool 全パートで共有する発音数
+     */
+    PartRouter(uint8_t available, uint8_t voice_pool) {
+        part_max = available < MAX_PARTS ? available : MAX_PARTS;
+        pool = voice_pool;
+        setMode(SYNTH_POLY);
+    }
+
+    /**
+     * @brief 演奏モードを設定します (パート設定は既定値に戻る)
+     * SYNTH_POLY / SYNTH_MONO / SYNTH_LEGATO: パート0のみ
+     * SYNTH_DUAL: 2パートを全音域で重ねる
+     * SYNTH_MULTI: パートnをチャンネルnで受信
+     * @return 本体のパート数が足りない場合 false
+     */
+    bool setMode(uint8_t m) {
+        uint8_t count;
+        switch(m) {
+            case SYNTH_POLY:
+            case SYNTH_MONO:
+            case SYNTH_LEGATO:
+                count = 1;
+                break;
+            case SYNTH_DUAL:
+                count = 2;
+                break;
+            case SYNTH_MULTI:
+                count = part_max;
+                break;
+            default:
+                return false;
+        }
+        if(count > part_max) return false;
+
+        mode = m;
+        part_count = count;
+        edit = 0;
+        for(uint8_t p = 0; p < MAX_PARTS; ++p) {
+            parts[p].channel = (m == SYNTH_MULTI) ? p : PART_OMNI;
+            parts[p].key_lo = 0;
+            parts[p].key_hi = 127;
+            parts[p].voices = (pool + count - 1) / count;
+        }
+        return true;
+    }
+
+    uint8_t getMode() {
+        return mode;
+    }
+
+    uint8_t getPartCount() {
+        return part_count;
+    }
+
+    /**
+     * @brief パートの割り当てを設定します
+     * @return 範囲外の場合 false
+     */
+    bool setPart(uint8_t part, uint8_t channel, uint8_t key_lo, uint8_t key_hi, uint8_t voices) {
+        if(part >= part_count) return false;
+        if(key_lo > 127) key_lo = 127;
+        if(key_hi > 127) key_hi = 127;
+        if(key_lo > key_hi) return false;
+        if(voices < 1) voices = 1;
+        else if(voices > pool) voices = pool;
+
+        parts[part].channel = (channel < 16) ? channel : PART_OMNI;
+        parts[part].key_lo = key_lo;
+        parts[part].key_hi = key_hi;
+        parts[part].voices = voices;
+        return true;
+    }
+
+    const Part& getPart(uint8_t part) {
+        return parts[part < MAX_PARTS ? part : 0];
+    }
+
+    bool setEditPart(uint8_t part) {
+        if(part >= part_count) return false;
+        edit = part;
+        return true;
+    }
+
+    uint8_t getEditPart() {
+        return edit;
+    }
+
+    /**
+     * @brief ノートの送り先を取得します
+     * @param channel 0~15 または PART_OMNI (I2C命令)
+     * @return 送り先パートのビットマスク
+     */
+    uint8_t route(uint8_t channel, uint8_t note) {
+        uint8_t mask = 0x00;
+        for(uint8_t p = 0; p < part_count; ++p) {
+            const Part& part = parts[p];
+            if(channel != PART_OMNI && part.channel != PART_OMNI && part.channel != channel) continue;
+            if(note < part.key_lo || note > part.key_hi) continue;
+            mask |= 1 << p;
+        }
+        return mask;
+    }
+
+    /**
+     * @brief チャンネル宛ての命令 (CC・ピッチベンド) の送り先を取得します
+     * @return 送り先パートのビットマスク
+     */
+    uint8_t routeChannel(uint8_t channel) {
+        uint8_t mask = 0x00;
+        for(uint8_t p = 0; p < part_count; ++p) {
+            if(channel == PART_OMNI || parts[p].channel == PART_OMNI || parts[p].channel == channel) {
+                mask |= 1 << p;
+            }
+        }
+        return mask;
+    }
+
+    /**
+     * @brief ボイスプールが埋まっている場合に発音を止めるパートを選びます
+     * @param used パート毎の発音数
+     * @param target 発音するパート
+     * @return 止めるパート (-1: 空きがある、または発音するパート自身で入れ替える)
+     */
+    int8_t pickVictim(const uint8_t* used, uint8_t target) {
+        uint8_t total = 0;
+        for(uint8_t p = 0; p < part_count; ++p) total += used[p];
+        if(total < pool) return -1;
+        if(used[target] >= parts[target].voices) return -1;
+
+        // 上限に対する超過が最も大きいパート
+        int8_t victim = -1;
+        int16_t worst = INT16_MIN;
+        for(uint8_t p = 0; p < part_count; ++p) {
+            if(p == target || used[p] == 0) continue;
+            int16_t over = used[p] - parts[p].voices;
+            if(over > worst) {
+                worst = over;
+                victim = p;
+            }
+        }
+        return victim;
+    }
+};
+
+#endif // PARTROUTER_H
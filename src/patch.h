@@ -0,0 +1,73 @@
+#ifndef PATCH_H
+#define PATCH_H
+
+#define PATCH_MAGIC   0x5044 // "DP"
+#define PATCH_VERSION 0x05
+
+#define PATCH_SHAPE_CUSTOM 0xFE // ユーザー波形
+#define PATCH_SHAPE_NONE   0xFF // 波形なし
+
+/// WaveGenerator のパラメータ一式 (プリセット用)
+/// 値は各setterに渡す値と同じ単位で保持する
+/// ユーザー波形のテーブルは含まない (PresetStore側で別に保存)
+/// 項目は末尾に追加し、追加した版より古いパッチでは初期値を使う
+struct Patch {
+    uint16_t magic;
+    uint8_t version;
+
+    // 波形 [osc1, osc2, sub]
+    uint8_t shape[3];
+
+    // ADSR
+    int16_t attack;  // ms
+    int16_t decay;   // ms
+    int16_t sustain; // 0 ~ 1000
+    int16_t release; // ms
+
+    // OSC [osc1, osc2] or [osc1, osc2, sub]
+    uint8_t voice[2];
+    uint8_t detune[2];
+    uint8_t spread[2];
+    int16_t osc_level[3]; // 0 ~ 1000
+    uint8_t osc_pan[3];   // 0 ~ 100
+    int8_t osc_oct[3];
+    int8_t osc_semi[3];
+    int8_t osc_cent[3];
+
+    // Amp
+    int16_t amp_level; // 0 ~ 1000
+    uint8_t amp_pan;   // 0 ~ 100
+
+    // Filter
+    uint8_t lpf_enabled;
+    float lpf_freq, lpf_q;
+    uint8_t hpf_enabled;
+    float hpf_freq, hpf_q;
+
+    // Delay
+    uint8_t delay_enabled;
+    int16_t delay_time;     // ms
+    int16_t delay_level;    // 0 ~ 1000
+    int16_t delay_feedback; // 0 ~ 1000
+
+    // その他
+    uint8_t mod; // 0x00: 加算, 0x01: リング, 0x02: FM
+    uint8_t monophonic;
+    uint8_t glide_enabled;
+    uint16_t glide_time; // ms
+
+    // 0x02~
+    uint8_t oversample;
+
+    // 0x03~
+    int16_t fm_index; // 0 ~ 1000
+
+    // 0x04~
+    uint8_t noise_type;  // 0x00: なし, 0x01: ホワイト, 0x02: ピンク
+    int16_t noise_level; // 0 ~ 1000
+
+    // 0x05~
+    uint8_t legato; // モノフォニック時のレガート
+};
+
+#endif // PATCH_H
@@ -0,0 +1,90 @@
+#ifndef PRESETSTORE_H
+#define PRESETSTORE_H
+
+#include <hardware/flash.h>
+#include <synth.h>
+
+/// プリセットスロット (フラッシュのファイルシステム領域を直接利用)
+///
+/// 1スロット = 3セクタ (12KB)
+///   0x0000 : Patch (1ページ)
+///   0x0100 : OSC1 ユーザー波形 (4096 byte)
+///   0x1100 : OSC2 ユーザー波形 (4096 byte)
+/// 読み出しはXIP経由のコピーのみで完了する
+#define PRESET_SLOTS       8
+#define PRESET_SLOT_SIZE   (3 * FLASH_SECTOR_SIZE)
+#define PRESET_PATCH_OFS   0x0000
+#define PRESET_TABLE1_OFS  0x0100
+#define PRESET_TABLE2_OFS  0x1100
+#define PRESET_TABLE_BYTES (2048 * sizeof(int16_t))
+
+// platformio.ini の board_build.filesystem_size で確保される領域
+extern uint8_t _FS_start;
+extern uint8_t _FS_end;
+
+class PresetStore {
+private:
+    const uint8_t* slotAddress(uint8_t slot) {
+        return &_FS_start + (uint32_t)slot * PRESET_SLOT_SIZE;
+    }
+
+    uint32_t slotOffset(uint8_t slot) {
+        return (uint32_t)((uintptr_t)slotAddress(slot) - XIP_BASE);
+    }
+
+public:
+    bool isValidSlot(uint8_t slot) {
+        if(slot >= PRESET_SLOTS) return false;
+        return slotAddress(slot) + PRESET_SLOT_SIZE <= &_FS_end;
+    }
+
+    /**
+     * @brief 現在のパラメータをスロットへ保存します
+     * 消去と書き込みの間は割り込みとコア1を停止します (数百ms)
+     */
+    bool save(uint8_t slot, WaveGenerator& wave) {
+        if(!isValidSlot(slot)) return false;
+
+        const Patch& patch = wave.getPatch();
+        uint8_t page[FLASH_PAGE_SIZE];
+        memset(page, 0xff, FLASH_PAGE_SIZE);
+        memcpy(page, &patch, sizeof(Patch));
+
+        uint32_t offset = slotOffset(slot);
+
+        rp2040.idleOtherCore();
+        noInterrupts();
+        flash_range_erase(offset, PRESET_SLOT_SIZE);
+        flash_range_program(offset + PRESET_PATCH_OFS, page, FLASH_PAGE_SIZE);
+        if(patch.shape[0] == PATCH_SHAPE_CUSTOM) {
+            flash_range_program(offset + PRESET_TABLE1_OFS, (const uint8_t*)wave.getCustomShape(0x01), PRESET_TABLE_BYTES);
+        }
+        if(patch.shape[1] == PATCH_SHAPE_CUSTOM) {
+            flash_range_program(offset + PRESET_TABLE2_OFS, (const uint8_t*)wave.getCustomShape(0x02), PRESET_TABLE_BYTES);
+        }
+        interrupts();
+        rp2040.resumeOtherCore();
+
+        return true;
+    }
+
+    /**
+     * @brief スロットからパラメータを読み出して適用します
+     * @return 空のスロット・遅延線やユーザー波形の領域が足りない場合 false
+     */
+    bool load(uint8_t slot, WaveGenerator& wave) {
+        if(!isValidSlot(slot)) return false;
+
+        const uint8_t* address = slotAddress(slot);
+        Patch patch;
+        memcpy(&patch, address + PRESET_PATCH_OFS, sizeof(Patch));
+
+        return wave.setPatch(
+            patch,
+            (const int16_t*)(address + PRESET_TABLE1_OFS),
+            (const int16_t*)(address + PRESET_TABLE2_OFS)
+        );
+    }
+};
+
+#endif // PRESETSTORE_H
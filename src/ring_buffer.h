@@ -1,55 +1,83 @@
 #ifndef RINGBUFFER_H
 #define RINGBUFFER_H
 
-#define RB_SIZE 16800 // 300ms (48000Hz)
-
+/// 遅延線用のリングバッファ
+/// 領域は持たず、attach() で割り当てられた領域 (SramArena) を使う
 class RingBuffer {
 private:
     int read_index = 0;
     int write_index = 0;
-    int16_t buff[RB_SIZE];
+    int16_t* buff = nullptr;
+    int size = 0;
 
 public:
-    RingBuffer() {
+    /**
+     * @brief 領域を設定します (内容は0で初期化)
+     * @param length サンプル数 (最大の遅延 + 1 以上)
+     */
+    void attach(int16_t* memory, int length) {
+        buff = memory;
+        size = length;
+        reset();
+    }
+
+    void detach() {
+        buff = nullptr;
+        size = 0;
+        read_index = 0;
         write_index = 0;
-        read_index = RB_SIZE / 2;
+    }
+
+    bool isAttached() {
+        return buff != nullptr;
+    }
+
+    int16_t* getBuffer() {
+        return buff;
+    }
 
-        memset(buff, 0, sizeof(int16_t) * RB_SIZE);
+    int getSize() {
+        return size;
     }
 
     void reset() {
+        if(buff == nullptr) return;
         write_index = 0;
-        read_index = RB_SIZE / 2;
+        read_index = size / 2;
 
-        memset(buff, 0, sizeof(int16_t) * RB_SIZE);
+        memset(buff, 0, sizeof(int16_t) * size);
     }
 
     void SetInterval(int interval) {
-        interval = interval % RB_SIZE;
+        if(buff == nullptr) return;
+        interval = interval % size;
         if(interval <= 0) {
             interval = 1;
         }
-        write_index = (read_index + interval) % RB_SIZE;
+        write_index = (read_index + interval) % size;
     }
 
     int16_t Read(int index = 0) {
+        if(buff == nullptr) return 0;
         int tmp = read_index + index;
         while(tmp < 0) {
-            tmp += RB_SIZE;
+            tmp += size;
         }
-        tmp = tmp % RB_SIZE;
+        tmp = tmp % size;
 
         return buff[tmp];
     }
 
     void Write(int16_t in) {
+        if(buff == nullptr) return;
         buff[write_index] = in;
     }
 
     void Update() {
-        read_index = (read_index + 1) % RB_SIZE;
-        write_index = (write_index + 1) % RB_SIZE;
+        if(buff == nullptr) return;
+        read_index = (read_index + 1) % size;
+        write_index = (write_index + 1) % size;
     }
 };
 
-#endif // RINGBUFFER_H
\ No newline at end of file
+#endif // RINGBUFFER_H
@@ -0,0 +1,206 @@
+#ifndef SRAMARENA_H
+#define SRAMARENA_H
+
+#define ARENA_BLOCKS 16 // 同時に割り当てられる領域の数
+#define ARENA_ALIGN  4  // 割り当ての境界 (byte)
+
+// 用途 (使用量の内訳)
+#define ARENA_DELAY 0x00 // ディレイの遅延線
+#define ARENA_WAVE  0x01 // ユーザー波形
+
+/// 固定容量の静的領域から遅延線・ユーザー波形を割り当てるアロケータ
+///
+/// 使わない機能の領域を確保したままにせず、パッチの読み込み時などに
+/// 必要な機能へ割り当て直す。ヒープは使わず、容量を超える割り当ては拒否する。
+/// 割り当ては先頭から最初に収まる隙間へ行い (first-fit)、
+/// 所有者 (パート) と用途を記録して使用量を報告できるようにする。
+class SramArena {
+private:
+    struct Block {
+        uint32_t offset;
+        uint32_t size;
+        uint8_t owner;
+        uint8_t kind;
+    };
+
+    uint8_t* memory;
+    uint32_t capacity;
+    Block blocks[ARENA_BLOCKS]; // offset順
+    uint8_t count = 0;
+    uint32_t used = 0;
+    uint32_t peak = 0;
+    uint32_t refused = 0;
+
+    static uint32_t align(uint32_t size) {
+        return (size + ARENA_ALIGN - 1) & ~(uint32_t)(ARENA_ALIGN - 1);
+    }
+
+    /**
+     * @brief 隙間の一覧を作ります
+     * @param owner この所有者の領域は空きとみなす (0xFF: なし)
+     * @return 隙間の数
+     */
+    uint8_t collectGaps(uint8_t owner, uint32_t* gap_offset, uint32_t* gap_size) {
+        uint8_t n = 0;
+        uint32_t pos = 0;
+        for(uint8_t b = 0; b < count; ++b) {
+            if(blocks[b].owner == owner) continue;
+            if(blocks[b].offset > pos) {
+                gap_offset[n] = pos;
+                gap_size[n] = blocks[b].offset - pos;
+                n++;
+            }
+            pos = blocks[b].offset + blocks[b].size;
+        }
+        if(capacity > pos) {
+            gap_offset[n] = pos;
+            gap_size[n] = capacity - pos;
+            n++;
+        }
+        return n;
+    }
+
+public:
+    /**
+     * @param buffer 静的に確保した領域 (ARENA_ALIGN 境界)
+     * @param size 容量 (byte)
+     */
+    SramArena(uint8_t* buffer, uint32_t size): memory(buffer), capacity(size) {}
+
+    /**
+     * @brief 領域を割り当てます (内容は0で初期化)
+     * @param owner 所有者 (パート番号)
+     * @param kind 用途 (ARENA_*)
+     * @return 収まらない場合 nullptr
+     */
+    void* allocate(uint32_t size, uint8_t owner, uint8_t kind) {
+        size = align(size);
+        if(size == 0 || count >= ARENA_BLOCKS) {
+            refused++;
+            return nullptr;
+        }
+
+        uint32_t gap_offset[ARENA_BLOCKS + 1];
+        uint32_t gap_size[ARENA_BLOCKS + 1];
+        uint8_t gaps = collectGaps(0xFF, gap_offset, gap_size);
+        for(uint8_t g = 0; g < gaps; ++g) {
+            if(gap_size[g] < size) continue;
+
+            // offset順に挿入
+            uint8_t b = count;
+            while(b > 0 && blocks[b - 1].offset > gap_offset[g]) {
+                blocks[b] = blocks[b - 1];
+                b--;
+            }
+            blocks[b] = {gap_offset[g], size, owner, kind};
+            count++;
+
+            used += size;
+            if(used > peak) peak = used;
+            memset(&memory[gap_offset[g]], 0, size);
+            return &memory[gap_offset[g]];
+        }
+        refused++;
+        return nullptr;
+    }
+
+    /**
+     * @brief 領域を解放します (nullptr は無視)
+     */
+    void release(const void* ptr) {
+        if(ptr == nullptr) return;
+        uint32_t offset = (uint32_t)((const uint8_t*)ptr - memory);
+        for(uint8_t b = 0; b < count; ++b) {
+            if(blocks[b].offset != offset) continue;
+            used -= blocks[b].size;
+            memmove(&blocks[b], &blocks[b + 1], (count - b - 1) * sizeof(Block));
+            count--;
+            return;
+        }
+    }
+
+    /**
+     * @brief 所有者の領域を割り当て直した場合に収まるかを確認します
+     * 所有者の現在の領域は空きとみなし、sizes を渡した順に first-fit で割り当てる
+     * (解放してから同じ順に allocate() した場合と同じ結果になる)
+     */
+    bool canFit(const uint32_t* sizes, uint8_t n, uint8_t owner) {
+        uint32_t gap_offset[ARENA_BLOCKS + 1];
+        uint32_t gap_size[ARENA_BLOCKS + 1];
+        uint8_t gaps = collectGaps(owner, gap_offset, gap_size);
+
+        uint8_t others = 0;
+        for(uint8_t b = 0; b < count; ++b) {
+            if(blocks[b].owner != owner) others++;
+        }
+        if(others + n > ARENA_BLOCKS) return false;
+
+        for(uint8_t i = 0; i < n; ++i) {
+            uint32_t size = align(sizes[i]);
+            uint8_t g = 0;
+            while(g < gaps && gap_size[g] < size) g++;
+            if(g == gaps) return false;
+            gap_offset[g] += size;
+            gap_size[g] -= size;
+        }
+        return true;
+    }
+
+    uint32_t getCapacity() {
+        return capacity;
+    }
+
+    uint32_t getUsed() {
+        return used;
+    }
+
+    /**
+     * @brief 用途別の使用量を取得します
+     */
+    uint32_t getUsed(uint8_t kind) {
+        uint32_t sum = 0;
+        for(uint8_t b = 0; b < count; ++b) {
+            if(blocks[b].kind == kind) sum += blocks[b].size;
+        }
+        return sum;
+    }
+
+    // 最も大きい隙間 (一度に割り当てられる上限)
+    uint32_t getLargestFree() {
+        uint32_t gap_offset[ARENA_BLOCKS + 1];
+        uint32_t gap_size[ARENA_BLOCKS + 1];
+        uint8_t gaps = collectGaps(0xFF, gap_offset, gap_size);
+        uint32_t largest = 0;
+        for(uint8_t g = 0; g < gaps; ++g) {
+            if(gap_size[g] > largest) largest = gap_size[g];
+        }
+        return largest;
+    }
+
+    uint32_t getPeak() {
+        return peak;
+    }
+
+    // 容量不足で拒否した割り当ての数
+    uint32_t getRefused() {
+        return refused;
+    }
+
+    /**
+     * @brief 使用状況をバイト列にします (リトルエンディアン)
+     * {capacity, used, peak, largest_free, delay, wave (u32), blocks, refused (u8)}
+     * @return 書き込んだバイト数
+     */
+    uint8_t serialize(uint8_t* out) {
+        uint32_t values[6] = {capacity, used, peak, getLargestFree(), getUsed(ARENA_DELAY), getUsed(ARENA_WAVE)};
+        uint8_t n = 0;
+        for(uint8_t v = 0; v < 6; ++v) {
+            for(uint8_t b = 0; b < 4; ++b) out[n++] = (values[v] >> (b * 8)) & 0xFF;
+        }
+        out[n++] = count;
+        out[n++] = refused > 0xFF ? 0xFF : refused;
+        return n;
+    }
+};
+
+#endif // SRAMARENA_H
@@ -1,12 +1,95 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
 #include <limits.h>
 #include <shape.h>
 #include <ring_buffer.h>
+#include <patch.h>
+#include <param_smoother.h>
+#include <governor.h>
+#include <halfband.h>
+#include <xorshift.h>
+#include <sram_arena.h>
 
 #define CALC_IDLE       0x00
 #define CALC_NOTE       0x01
-#define CALC_SET_F      0x02
 #define CALC_PAN_FILTER 0x03
 
+// CORE1へ処理を依頼
+// ホスト(SYNTH_NATIVE)ではCORE1が無いため依頼した時点でその場で処理する
+#ifdef SYNTH_NATIVE
+    #define START_CORE1(mode) calc_mode = (mode); generate1()
+#else
+    #define START_CORE1(mode) calc_mode = (mode)
+#endif
+
+// I2C割り込みと共有するフラグを読み出してクリアする間は割り込みを止める
+// ホスト(SYNTH_NATIVE)では割り込みが無いため何もしない
+#ifdef SYNTH_NATIVE
+    #define IRQ_LOCK()
+    #define IRQ_UNLOCK()
+#else
+    #define IRQ_LOCK()   noInterrupts()
+    #define IRQ_UNLOCK() interrupts()
+#endif
+
+// 出力フレーム (I2Sへそのまま渡す, 上位16bit: L, 下位16bit: R)
+#define FRAME_PACK(l, r) (((uint32_t)(uint16_t)(l) << 16) | (uint16_t)(r))
+#define FRAME_L(f)       ((int16_t)((f) >> 16))
+#define FRAME_R(f)       ((int16_t)((f) & 0xffff))
+
+#define UPDATE_SPREAD_PAN 0x01
+#define UPDATE_LPF        0x02
+#define UPDATE_HPF        0x04
+#define UPDATE_DELAY      0x08
+#define UPDATE_DELAY_RST  0x10
+#define UPDATE_DETUNE     0x20
+
+// 発音中ノートの再計算対象
+#define RETUNE_OSC1        0x01 // OSC1の音程
+#define RETUNE_OSC2        0x02 // OSC2の音程
+#define RETUNE_SUB         0x04 // SUB OSCの音程
+#define RETUNE_OSC1_DETUNE 0x08 // OSC1のデチューン・ボイス数
+#define RETUNE_OSC2_DETUNE 0x10 // OSC2のデチューン・ボイス数
+#define RETUNE_PITCH       0x07
+#define RETUNE_ALL         0x1F
+
+// エンベロープの段階 (getNoteState)
+#define ENV_IDLE          0x00 // 空き
+#define ENV_ATTACK        0x01
+#define ENV_DECAY         0x02
+#define ENV_SUSTAIN       0x03
+#define ENV_RELEASE       0x04
+#define ENV_FORCE_RELEASE 0x05 // 入れ替え・負荷制御による停止中
+
+#define PITCH_MAX   13199 // 位相増分テーブルの上限 (ノート131 + 99cent)
+#define RATIO_SHIFT 30    // 比率テーブルの固定小数点 (1.0 = 1 << 30)
+
+#define CONTROL_RATE 32 // コントロールレート (サンプル)
+
+#define FM_SHIFT 9 // FMの位相オフセットのスケール (index 1000 で約2周期)
+
+#define DELAY_MAX_MS 300 // ディレイ時間の上限 (遅延線の長さ)
+
+// ノイズOSC
+#define NOISE_OFF   0x00
+#define NOISE_WHITE 0x01
+#define NOISE_PINK  0x02
+#define NOISE_BUF   (CONTROL_RATE * 2) // コントロールレート1回分 (オーバーサンプリング時は2倍)
+
+// MIDI CC
+#define CC_FM_INDEX   1
+#define CC_VOLUME     7
+#define CC_PAN        10
+#define CC_OSC1_LEVEL 16
+#define CC_OSC2_LEVEL 17
+#define CC_SUB_LEVEL  18
+#define CC_LEGATO     68 // レガートフットスイッチ (64以上で有効)
+#define CC_CUTOFF     74
+#define CC_ALL_NOTES_OFF 123 // 鳴っているノートを全てリリース
+
+#define MONO_STACK 10 // レガートで保持する押鍵数
+
 #define FIXED_SHIFT 16
 #define FIXED_ONE (1 << FIXED_SHIFT)
 #define PI_4 ((int32_t)(M_PI_4 * FIXED_ONE))
@@ -26,16 +109,17 @@
 
 // エイリアシングの確認
 // パラメータ変更時の動作確認
-// リアルタイムでパラメータ変更(MIDI CC)
 
 class WaveGenerator {
 private:
 
     // 定数
     static const int MAX_NOTES = 4;
+    static const int FADE_SLOTS = 2; // 入れ替えたノートのフェード用 (core0/core1に1つずつ)
+    static const int NOTE_SLOTS = MAX_NOTES + FADE_SLOTS;
     static const int MAX_VOICE = 8;
     static const size_t SAMPLE_SIZE = 2048;
-    const int32_t SAMPLE_RATE;
+    int32_t sample_rate; // 変更は setSampleRate() から
     const uint8_t BIT_SHIFT = bitShift(SAMPLE_SIZE);
     const float HALFTONE = pow(2.0, 1.0 / 12.0) - 1.0;
     const uint16_t DIVIDE_FIXED[7] = {141, 173, 200, 224, 245, 265, 283};
@@ -68,12 +152,12 @@ private:
 
     // コア1制御用(コア0からもアクセスあり)
     volatile uint8_t calc_mode = CALC_IDLE;
-    volatile int8_t calc_i = 0x00;
-    volatile uint8_t calc_note = 0x00;
     volatile int16_t calc_r;
     volatile uint16_t calc_divide;
     volatile int16_t calc_result_L;
     volatile int16_t calc_result_R;
+    volatile int16_t calc_result_L2; // オーバーサンプリング時の中間サンプル
+    volatile int16_t calc_result_R2;
 
     // ノート用パラメータ
     struct Note {
@@ -85,6 +169,10 @@ private:
         uint32_t osc2_phase_delta[MAX_VOICE];
         uint32_t osc_sub_phase_delta;
 
+        // デチューン前の位相増分 (ベンド込み)
+        uint32_t osc1_base_delta;
+        uint32_t osc2_base_delta;
+
         uint32_t osc1_glide_delta[MAX_VOICE];
         uint32_t osc2_glide_delta[MAX_VOICE];
         uint32_t osc_sub_glide_delta;
@@ -110,8 +198,21 @@ private:
         int32_t decay_cnt;
         int32_t release_cnt;
         int32_t force_release_cnt;
+
+        // 遅延計測用 (最初の発音サンプル位置)
+        bool started;
+        int16_t start_index;
+
+        // ユニゾンの間引き (負荷制御用)
+        uint8_t unison_step;
+        uint8_t osc1_mask; // 生成するボイス (bit d = ボイス d)
+        uint8_t osc2_mask;
+        uint16_t osc1_divide;
+        uint16_t osc2_divide;
     };
-    volatile Note notes[MAX_NOTES]; // core1でも利用する
+    // core1でも利用する
+    // [MAX_NOTES, NOTE_SLOTS) は入れ替えたノートの強制リリースのみを生成するフェード用スロット
+    volatile Note notes[NOTE_SLOTS];
 
     // 生成できていないノートを保持するキャッシュ
     struct NoteCache {
@@ -121,21 +222,51 @@ private:
     };
     NoteCache cache[MAX_NOTES];
 
+    // ブロック内で最後に生成したサンプル位置 (-1: ブロック外)
+    volatile int16_t render_index = -1;
+
+    // 同時発音数の上限 (マルチティンバーのパート毎の割り当て)
+    uint8_t note_limit = MAX_NOTES;
+
+    // 負荷制御
+    uint8_t gov_level = GOV_NORMAL;
+    volatile bool gov_skip_sub = false;
+    uint32_t gov_steals = 0;      // 早期停止したノート数
+    uint32_t gov_reduced = 0;     // ユニゾンを間引いたノート×ブロック数
+    uint32_t gov_sub_skipped = 0; // サブOSCを省略したブロック数
+
+    // 直前のブロックで発音を開始したノート
+    uint8_t started_count = 0;
+    uint8_t started_note[MAX_NOTES];
+    uint16_t started_index[MAX_NOTES];
+
     // グライド用
     volatile bool monophonic = false;  // モノフォニック
     volatile bool glide_mode = false;  // グライドモードが有効か
     volatile bool isGlided = false;    // グライドモード有効後にノートが押されたか
     volatile uint16_t glide_time = 15; // グライド時間(ms)
 
+    // レガート (モノフォニック時、押鍵が重なったノートへ発音を引き継ぐ)
+    volatile bool legato = false;
+    uint8_t held_notes[MONO_STACK]; // 押鍵中のノート (末尾が最新)
+    uint8_t held_count = 0;
+
+    // ピッチベンド
+    static const int16_t BEND_RANGE = 200; // ±cent
+    volatile int16_t bend_cent = 0;
+
     // Master
     int16_t amp_gain = 1024;   // 1.0% = 1024 (in1000 = out1024)
     volatile uint8_t pan = 50; // 0=L, 50=C, 100=R
+    int16_t volume = 1024;     // MIDI CC7 (1.0 = 1024)
+    volatile int32_t pan_gain_L = 23169; // パン×ボリューム (32767 = 1.0)
+    volatile int32_t pan_gain_R = 23169;
 
     // 波形
     volatile int16_t* osc1_wave = sine;
     volatile int16_t* osc2_wave = nullptr;
-    int16_t osc1_cwave[SAMPLE_SIZE];
-    int16_t osc2_cwave[SAMPLE_SIZE];
+    int16_t* osc1_cwave = nullptr; // ユーザー波形 (SramArenaから割り当て)
+    int16_t* osc2_cwave = nullptr;
 
     // サブ波形(ユーザー波形設定不可)
     volatile int16_t* osc_sub_wave = nullptr;
@@ -143,15 +274,36 @@ private:
     // OSC特殊合成モード
     volatile bool ring_modulation = false;
 
+    // 2倍オーバーサンプリング (リングモジュレーション・高音ユニゾンの折り返し対策)
+    volatile bool oversampling = false; // 設定値
+    volatile bool os_active = false;    // 現在のブロックで有効か (ブロック先頭で反映)
+    HalfBandDecimator decimator_L, decimator_R;
+
     // OSCパラメータ
     volatile uint8_t osc1_voice = 1; // 通常時ボイス数8まで
     volatile uint8_t osc2_voice = 1;
     volatile float osc1_detune = 0.2f; // 0.0f ~ 1.0f
     volatile float osc2_detune = 0.2f;
+
+    // 位相増分テーブル (ノートオン時は整数演算のみ)
+    uint32_t top_octave_delta[12]; // ノート120~131の位相増分
+    uint32_t cent_ratio[100];      // 2^(cent/1200)
+    uint32_t osc1_detune_ratio[MAX_VOICE]; // ユニゾン各ボイスのデチューン比
+    uint32_t osc2_detune_ratio[MAX_VOICE];
+    volatile uint8_t retune_flags = 0x00; // 発音中ノートの再計算待ち (RETUNE_*)
     uint8_t osc1_spread = 50; // MAX100
     uint8_t osc2_spread = 50;
     volatile int32_t osc1_spread_pan[MAX_VOICE][2]; // [voice][cos|sin]
     volatile int32_t osc2_spread_pan[MAX_VOICE][2];
+
+    // OSCパン (スプレッドのゲインに含める)
+    uint8_t osc1_pan = 50; // 0=L, 50=C, 100=R
+    uint8_t osc2_pan = 50;
+    uint8_t osc_sub_pan = 50;
+    volatile int32_t osc_sub_pan_gain[1][2];
+    volatile bool osc1_panned = false; // 1ボイス時にゲインを掛けるか
+    volatile bool osc2_panned = false;
+    volatile bool osc_sub_panned = false;
     volatile int8_t osc1_oct = 0; // -4 ~ 4
     volatile int8_t osc2_oct = 0;
     volatile int8_t osc1_semi = 0; // -12 ~ 12
@@ -167,17 +319,42 @@ private:
     volatile int8_t osc_sub_cent = 0;
     volatile int16_t osc_sub_level = 1024;
 
+    // FM (OSC2でOSC1の位相を変調)
+    volatile bool fm_modulation = false;
+    volatile int32_t fm_index = 0; // 0 ~ 1000
+
+    // ノイズOSC (全ノートで共有し、ノート毎のエンベロープを掛ける)
+    volatile uint8_t noise_type = NOISE_OFF;
+    volatile int16_t noise_level = 1024;
+    int16_t noise_buf[NOISE_BUF]; // コントロールレート毎に生成
+    int32_t pink_b0 = 0, pink_b1 = 0, pink_b2 = 0; // ピンクノイズのフィルタ状態
+
+    // 乱数 (ノートオン時の位相・ノイズ)
+    XorShift32 phase_rng;
+    XorShift32 noise_rng;
+
+    // 平滑化 (コントロールレートで追従)
+    ParamSmoother osc1_level_sm = ParamSmoother(1024);
+    ParamSmoother osc2_level_sm = ParamSmoother(1024);
+    ParamSmoother osc_sub_level_sm = ParamSmoother(1024);
+    ParamSmoother pan_gain_L_sm = ParamSmoother(23169);
+    ParamSmoother pan_gain_R_sm = ParamSmoother(23169);
+    ParamSmoother fm_index_sm = ParamSmoother(0);
+    ParamSmoother noise_level_sm = ParamSmoother(1024);
+
     // ADSR
     int16_t sustain_level = 1024; // 1.0% = 1024 (in1000 = out1024)
     int16_t level_diff = 0; // 1.0% = 1024 (in1000 = out1024)
-    int32_t attack_sample = (1 * SAMPLE_RATE) >> 10;
-    int32_t decay_sample = (SAMPLE_RATE << 10) >> 10;
-    int32_t release_sample = (10 * SAMPLE_RATE) >> 10;
-    int32_t force_release_sample = (10 * SAMPLE_RATE) >> 10; // 強制Release
+    int32_t attack_sample = (1 * sample_rate) >> 10;
+    int32_t decay_sample = (sample_rate << 10) >> 10;
+    int32_t release_sample = (10 * sample_rate) >> 10;
+    int32_t force_release_sample = (10 * sample_rate) >> 10; // 強制Release
 
     // LPF 初期値 1000Hz 1/sqrt(2)
     // 推奨値 freq 20～20,000 q 0.02～40.0
     bool lpf_enabled = false;
+    float lpf_freq = 1000.0f, lpf_q = 1.0f/sqrt(2.0f);
+    float lpf_target = 1000.0f; // カットオフの目標値 (ブロック毎に追従)
     int32_t lp_f0_L, lp_f1_L, lp_f2_L, lp_f3_L, lp_f4_L;
     int32_t lp_f0_R, lp_f1_R, lp_f2_R, lp_f3_R, lp_f4_R;
     int32_t lp_in1_L = 0, lp_in2_L = 0; // バッファ
@@ -188,6 +365,7 @@ private:
     // HPF 初期値 500Hz 1/sqrt(2)
     // 推奨値 freq 20～20,000 q 0.02～40.0
     bool hpf_enabled = false;
+    float hpf_freq = 500.0f, hpf_q = 1.0f/sqrt(2.0f);
     int32_t hp_f0_L, hp_f1_L, hp_f2_L, hp_f3_L, hp_f4_L;
     int32_t hp_f0_R, hp_f1_R, hp_f2_R, hp_f3_R, hp_f4_R;
     int32_t hp_in1_L = 0, hp_in2_L = 0;
@@ -196,12 +374,25 @@ private:
     int32_t hp_out1_R = 0, hp_out2_R = 0;
 
     // ディレイエフェクト(Effect)
-    RingBuffer ringbuff_L, ringbuff_R;
+    RingBuffer ringbuff_L, ringbuff_R; // 有効な間のみ SramArena から割り当て
     bool delay_enabled = false;
     int16_t time; // ms
     int16_t level; // 1.0 = 1024
     int16_t feedback; // 0.5 = 512
     uint32_t delay_long = 0;
+    int delay_sample = 0;
+    volatile bool delay_release = false; // 無効にした遅延線をブロック境界で返す
+
+    // 現在のパラメータ (プリセット保存用)
+    Patch patch;
+
+    // 遅延線・ユーザー波形の割り当て元 (全パートで共有)
+    SramArena* arena = nullptr;
+    uint8_t arena_owner = 0;
+
+    // バッチ更新用 (派生値の計算をendUpdateまで遅延)
+    bool batch_update = false;
+    uint8_t batch_dirty = 0x00;
 
     // ビットシフト
     uint8_t bitShift(size_t tableSize) {
@@ -218,19 +409,57 @@ private:
         return a + t * (b - a);
     }
 
-    // MIDIノートを周波数に変換
-    float midiNoteToFrequency(uint8_t midiNote, int8_t cent) {
-        float frequency = 440.0 * pow(2.0, (midiNote - 69) / 12.0);
-        return frequency * pow(2.0, cent / 1200.0);
+    // 位相増分テーブルを作成 (サンプルレート依存, 起動時のみ)
+    void initPitchTable() {
+        for(uint8_t k = 0; k < 12; ++k) {
+            double freq = 440.0 * pow(2.0, (120 + k - 69) / 12.0);
+            top_octave_delta[k] = (uint32_t)(freq * 4294967296.0 / sample_rate + 0.5);
+        }
+        for(uint8_t c = 0; c < 100; ++c) {
+            cent_ratio[c] = (uint32_t)(pow(2.0, c / 1200.0) * (1 << RATIO_SHIFT) + 0.5);
+        }
     }
 
-    // ノート番号を周波数に変換
-    void setFrequency(int noteIndex) {
-        if (noteIndex >= 0 && noteIndex < MAX_NOTES) {
+    // デチューン比テーブルを作成 (デチューン・ボイス数の変更時)
+    void initDetuneRatio() {
+        for(uint8_t d = 0; d < osc1_voice; ++d) {
+            const auto pos = osc1_voice == 1 ? 0.0f : lerp(-1.0f, 1.0f, 1.0f * d / (osc1_voice - 1));
+            osc1_detune_ratio[d] = (uint32_t)((1.0f + HALFTONE * osc1_detune * pos) * (1 << RATIO_SHIFT));
+        }
+        for(uint8_t d = 0; d < osc2_voice; ++d) {
+            const auto pos = osc2_voice == 1 ? 0.0f : lerp(-1.0f, 1.0f, 1.0f * d / (osc2_voice - 1));
+            osc2_detune_ratio[d] = (uint32_t)((1.0f + HALFTONE * osc2_detune * pos) * (1 << RATIO_SHIFT));
+        }
+    }
 
-            float osc1_freq =  midiNoteToFrequency(calc_note + (osc1_oct * 12) + (osc1_semi), osc1_cent);
-            float osc2_freq =  midiNoteToFrequency(calc_note + (osc2_oct * 12) + (osc2_semi), osc2_cent);
-            float osc_sub_freq =  midiNoteToFrequency(calc_note + (osc_sub_oct * 12) + (osc_sub_semi), osc_sub_cent);
+    /**
+     * @brief ピッチを位相増分に変換します
+     * @param pitch ノート番号×100 + cent
+     */
+    uint32_t pitchToDelta(int32_t pitch) {
+        if(pitch < 0) pitch = 0;
+        else if(pitch > PITCH_MAX) pitch = PITCH_MAX;
+
+        uint16_t semi = pitch / 100;
+        uint8_t cent = pitch - semi * 100;
+        uint8_t oct = semi / 12;
+        uint8_t key = semi - oct * 12;
+
+        // 最上位オクターブの値から右シフトでオクターブを下げる
+        uint64_t delta = ((uint64_t)top_octave_delta[key] * cent_ratio[cent]) >> (RATIO_SHIFT + 10 - oct);
+        if(delta > INT32_MAX) delta = INT32_MAX; // ナイキスト周波数で制限
+        return delta;
+    }
+
+    /**
+     * @brief ノート番号を位相増分に変換します
+     * @param flags 再計算するOSC (RETUNE_*)
+     * デチューンのみの変更はキャッシュした基準の位相増分から計算する
+     */
+    void setFrequency(int noteIndex, uint8_t note, uint8_t flags = RETUNE_ALL) {
+        if (noteIndex >= 0 && noteIndex < NOTE_SLOTS) {
+
+            int16_t bend = bend_cent;
 
             // 変数キャッシュ
             volatile Note* p_note = &notes[noteIndex];
@@ -238,52 +467,98 @@ private:
             volatile uint32_t* osc2_phase_delta = &p_note->osc2_phase_delta[0];
 
             // osc1処理
-            if(osc1_voice == 1) {
-                *osc1_phase_delta = osc1_freq * (float)(1ULL << 32) / SAMPLE_RATE;
+            if(flags & RETUNE_OSC1) {
+                p_note->osc1_base_delta = pitchToDelta((note + (osc1_oct * 12) + osc1_semi) * 100 + osc1_cent + bend);
             }
-            else {
-                for(uint8_t d = 0; d < osc1_voice; ++d, ++osc1_phase_delta) {
-                    const auto pos = lerp(-1.0f, 1.0f, 1.0f * d / (osc1_voice - 1));
-                    float detuneFactor = static_cast<float>(1.0 + HALFTONE * osc1_detune * pos);
-                    *osc1_phase_delta = (osc1_freq * detuneFactor) * (float)(1ULL << 32) / SAMPLE_RATE;
+            if(flags & (RETUNE_OSC1 | RETUNE_OSC1_DETUNE)) {
+                uint32_t osc1_delta = p_note->osc1_base_delta;
+                if(osc1_voice == 1) {
+                    *osc1_phase_delta = osc1_delta;
+                }
+                else {
+                    for(uint8_t d = 0; d < osc1_voice; ++d, ++osc1_phase_delta) {
+                        *osc1_phase_delta = ((uint64_t)osc1_delta * osc1_detune_ratio[d]) >> RATIO_SHIFT;
+                    }
                 }
             }
 
             // osc2処理
-            if(osc2_voice == 1) {
-                *osc2_phase_delta = osc2_freq * (float)(1ULL << 32) / SAMPLE_RATE;
+            if(flags & RETUNE_OSC2) {
+                p_note->osc2_base_delta = pitchToDelta((note + (osc2_oct * 12) + osc2_semi) * 100 + osc2_cent + bend);
             }
-            else {
-                for(uint8_t d = 0; d < osc2_voice; ++d, ++osc2_phase_delta) {
-                    const auto pos = lerp(-1.0f, 1.0f, 1.0f * d / (osc2_voice - 1));
-                    float detuneFactor = static_cast<float>(1.0 + HALFTONE * osc2_detune * pos);
-                    *osc2_phase_delta = (osc2_freq * detuneFactor) * (float)(1ULL << 32) / SAMPLE_RATE;
+            if(flags & (RETUNE_OSC2 | RETUNE_OSC2_DETUNE)) {
+                uint32_t osc2_delta = p_note->osc2_base_delta;
+                if(osc2_voice == 1) {
+                    *osc2_phase_delta = osc2_delta;
+                }
+                else {
+                    for(uint8_t d = 0; d < osc2_voice; ++d, ++osc2_phase_delta) {
+                        *osc2_phase_delta = ((uint64_t)osc2_delta * osc2_detune_ratio[d]) >> RATIO_SHIFT;
+                    }
                 }
             }
 
             // sub osc処理
-            p_note->osc_sub_phase_delta = osc_sub_freq * (float)(1ULL << 32) / SAMPLE_RATE;
+            if(flags & RETUNE_SUB) {
+                p_note->osc_sub_phase_delta = pitchToDelta((note + (osc_sub_oct * 12) + osc_sub_semi) * 100 + osc_sub_cent + bend);
+            }
         }
     }
 
-    void initSpreadPan() {
-        volatile int32_t (*p_osc1_spread_pan)[2] = &osc1_spread_pan[0];
-        volatile int32_t (*p_osc2_spread_pan)[2] = &osc2_spread_pan[0];
+    // 音程・デチューンの変更を発音中のノートへ反映 (コントロールレート)
+    void applyRetune() {
+        // 読み出した後に割り込みで立ったフラグは次回に残す
+        IRQ_LOCK();
+        uint8_t flags = retune_flags;
+        retune_flags &= ~flags;
+        IRQ_UNLOCK();
 
-        for (uint8_t d = 0; d < osc1_voice; ++d, ++p_osc1_spread_pan) {
-            const auto osc1_pos = lerp(-1.0f, 1.0f, 1.0f * d / (osc1_voice - 1));
-            float osc1_angle = M_PI_4 * (1.0f + osc1_pos * (osc1_spread / 100.0f));
-            *p_osc1_spread_pan[0] = (int32_t)(cos(osc1_angle) * FIXED_ONE); // X = cos
-            *p_osc1_spread_pan[1] = (int32_t)(sin(osc1_angle) * FIXED_ONE); // Y = sin
+        volatile Note* p_note = &notes[0];
+        for(uint8_t n = 0; n < NOTE_SLOTS; ++n, ++p_note) {
+            if(p_note->active) setFrequency(n, p_note->note, flags);
         }
-        for (uint8_t d = 0; d < osc2_voice; ++d, ++p_osc2_spread_pan) {
-            const auto osc2_pos = lerp(-1.0f, 1.0f, 1.0f * d / (osc2_voice - 1));
-            float osc2_angle = M_PI_4 * (1.0f + osc2_pos * (osc2_spread / 100.0f));
-            *p_osc2_spread_pan[0] = (int32_t)(cos(osc2_angle) * FIXED_ONE); // X = cos
-            *p_osc2_spread_pan[1] = (int32_t)(sin(osc2_angle) * FIXED_ONE); // Y = sin
+    }
+
+    // OSC番号から再計算対象を取得
+    uint8_t retuneFlag(uint8_t osc) {
+        if(osc == 0x01) return RETUNE_OSC1;
+        if(osc == 0x02) return RETUNE_OSC2;
+        if(osc == 0x03) return RETUNE_SUB;
+        return 0x00;
+    }
+
+    /**
+     * @brief スプレッドとOSCパンから各ボイスのゲイン (等パワー) を作成します
+     * 1ボイスのときは中央で1.0になるよう√2倍する (パンなしの加算と同じ音量)
+     */
+    void initPanGain(volatile int32_t (*gain)[2], uint8_t voice, uint8_t spread, uint8_t pan) {
+        float offset = M_PI_4 * ((pan - 50) / 50.0f);
+        float scale = (voice == 1) ? M_SQRT2 * FIXED_ONE : FIXED_ONE;
+
+        for (uint8_t d = 0; d < voice; ++d) {
+            float angle = M_PI_4 + offset;
+            if(voice > 1) {
+                const auto pos = lerp(-1.0f, 1.0f, 1.0f * d / (voice - 1));
+                angle += M_PI_4 * pos * (spread / 100.0f);
+            }
+            if(angle < 0.0f) angle = 0.0f;
+            else if(angle > M_PI_2) angle = M_PI_2;
+            gain[d][0] = (int32_t)(cos(angle) * scale); // X = cos
+            gain[d][1] = (int32_t)(sin(angle) * scale); // Y = sin
         }
     }
 
+    void initSpreadPan() {
+        initPanGain(osc1_spread_pan, osc1_voice, osc1_spread, osc1_pan);
+        initPanGain(osc2_spread_pan, osc2_voice, osc2_spread, osc2_pan);
+        initPanGain(osc_sub_pan_gain, 1, 0, osc_sub_pan);
+
+        // 中央なら1ボイス時はゲインを掛けない
+        osc1_panned = osc1_pan != 50;
+        osc2_panned = osc2_pan != 50;
+        osc_sub_panned = osc_sub_pan != 50;
+    }
+
     int16_t lpfProcessL(int16_t in, int16_t mix = 1 << 10) {
         int16_t out = ((lp_f0_L * in) + (lp_f1_L * lp_in1_L) + (lp_f2_L * lp_in2_L) - (lp_f3_L * lp_out1_L) - (lp_f4_L * lp_out2_L)) >> FIXED_SHIFT;
         lp_in2_L = lp_in1_L;
@@ -322,7 +597,7 @@ private:
 
     void lowPass(float freq, float q) {
         // フィルタ係数計算で使用する中間値を求める。
-        float omega = 2.0f * M_PI *  freq / (float)SAMPLE_RATE;
+        float omega = 2.0f * M_PI *  freq / (float)sample_rate;
         float alpha = sin(omega) / (2.0f * q);
 
         // フィルタ係数を求める。
@@ -342,7 +617,7 @@ private:
 
     void highPass(float freq, float q) {
         // フィルタ係数計算で使用する中間値を求める。
-        float omega = 2.0f * M_PI *  freq / (float)SAMPLE_RATE;
+        float omega = 2.0f * M_PI *  freq / (float)sample_rate;
         float alpha = sin(omega) / (2.0f * q);
 
         // フィルタ係数を求める。
@@ -397,9 +672,10 @@ private:
         uint8_t min = 0xff;
         volatile Note* p_note = &notes[0];
 
+        bool full = getActiveNote() >= note_limit;
         for(uint8_t i = 0; i < MAX_NOTES; ++i, ++p_note) {
-            if(getActiveNote() == MAX_NOTES) {
-                if(p_note->actnum < min){
+            if(full) {
+                if(p_note->active && p_note->actnum < min){
                     min = p_note->actnum;
                     index = i;
                 }
@@ -420,6 +696,90 @@ private:
         return index;
     }
 
+    /**
+     * @brief 押鍵中のノートに追加します (既にある場合は最新にする)
+     */
+    void pushHeld(uint8_t note) {
+        removeHeld(note);
+        if(held_count >= MONO_STACK) {
+            // 最も古い押鍵を捨てる
+            memmove(&held_notes[0], &held_notes[1], MONO_STACK - 1);
+            held_count--;
+        }
+        held_notes[held_count++] = note;
+    }
+
+    /**
+     * @brief 押鍵中のノートから削除します
+     * @return 押鍵中だった場合 true
+     */
+    bool removeHeld(uint8_t note) {
+        for(uint8_t n = 0; n < held_count; ++n) {
+            if(held_notes[n] != note) continue;
+            memmove(&held_notes[n], &held_notes[n + 1], held_count - n - 1);
+            held_count--;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief モノフォニックのノートが鳴り続けているか (リリース・強制リリース中でない)
+     */
+    bool isMonoSounding() {
+        volatile Note* p_note = &notes[0];
+        return p_note->active && p_note->release_cnt < 0 && p_note->force_release_cnt < 0;
+    }
+
+    /**
+     * @brief 鳴っているモノフォニックのノートの音程を切り替えます (レガート)
+     * エンベロープ・位相・音量はそのままで位相増分のみ変える (グライド有効時は補間で追従)
+     */
+    void retargetNote(uint8_t note) {
+        volatile Note* p_note = &notes[0];
+        setFrequency(0, note);
+        p_note->note = note;
+        cache[0].processed = true;
+
+        // 次に生成されるサンプルから新しい音程
+        p_note->start_index = render_index + 1;
+        p_note->started = true;
+    }
+
+    /**
+     * @brief 入れ替えるノートをフェード用スロットへ移します
+     * 強制リリースの残りはスロットで生成し、元のボイスは直ちに次のノートに使える
+     * @return 空きスロットが無い場合 false
+     */
+    bool moveToFade(uint8_t noteIndex) {
+        volatile Note* i_note = &notes[noteIndex];
+        volatile Note* p_fade = &notes[MAX_NOTES];
+
+        for(uint8_t n = MAX_NOTES; n < NOTE_SLOTS; ++n, ++p_fade) {
+            if(p_fade->active) continue;
+
+            memcpy((void*)p_fade, (const void*)i_note, sizeof(Note));
+            // 強制停止専用release (負荷制御で停止中の場合はそのまま)
+            if(p_fade->force_release_cnt < 0) {
+                p_fade->note_off_gain = p_fade->adsr_gain;
+                p_fade->force_release = force_release_sample;
+                p_fade->force_release_cnt = force_release_sample;
+            }
+            p_fade->attack_cnt = -1;
+            p_fade->decay_cnt = -1;
+            p_fade->actnum = -1;
+            p_fade->started = false;
+
+            // 元のボイスは発音終了と同じ扱い
+            updateActNumOff(noteIndex); // 更新してから-1にする
+            i_note->actnum = -1;
+            i_note->active = false;
+            i_note->note = 0xff;
+            return true;
+        }
+        return false;
+    }
+
     void updateActNumOn(int noteIndex) {
         volatile Note* i_note = &notes[noteIndex];
 
@@ -474,7 +834,7 @@ private:
         volatile uint32_t* osc2_phase = i_note->osc2_phase;
 
         for(uint8_t i = 0; i < MAX_VOICE; ++i) {
-            uint32_t random = rand();
+            uint32_t random = phase_rng.next();
             i_note->osc1_phase[i] = random;
             i_note->osc2_phase[i] = random;
 
@@ -494,6 +854,426 @@ private:
         i_note->osc_sub_phase_delta = 0;
     }
 
+    void initPatch() {
+        memset(&patch, 0, sizeof(Patch));
+        patch.magic = PATCH_MAGIC;
+        patch.version = PATCH_VERSION;
+        patch.shape[0] = 0x00;
+        patch.shape[1] = PATCH_SHAPE_NONE;
+        patch.shape[2] = PATCH_SHAPE_NONE;
+        patch.attack = 1;
+        patch.decay = 1000;
+        patch.sustain = 1000;
+        patch.release = 10;
+        for(uint8_t i = 0; i < 2; ++i) {
+            patch.voice[i] = 1;
+            patch.detune[i] = 20;
+            patch.spread[i] = 50;
+        }
+        for(uint8_t i = 0; i < 3; ++i) {
+            patch.osc_level[i] = 1000;
+            patch.osc_pan[i] = 50;
+        }
+        patch.amp_level = 1000;
+        patch.amp_pan = 50;
+        patch.lpf_freq = lpf_freq;
+        patch.lpf_q = lpf_q;
+        patch.hpf_freq = hpf_freq;
+        patch.hpf_q = hpf_q;
+        patch.delay_time = 250;
+        patch.delay_level = 300;
+        patch.delay_feedback = 500;
+        patch.glide_time = 15;
+        patch.noise_type = NOISE_OFF;
+        patch.noise_level = 1000;
+    }
+
+    /**
+     * @brief オーバーサンプリング用の中間サンプルを生成します
+     * 現在の位相から位相増分の1/2だけ進めた位置を読む (位相は更新しない)
+     * 両コアから呼ばれるためノート単位の状態のみ扱う
+     */
+    void renderMidSample(volatile Note* p_note, uint8_t osc1_v, uint8_t osc2_v,
+                         int16_t osc1_pre_level, int16_t osc2_pre_level, int16_t osc_sub_pre_level,
+                         bool skip_sub, bool fm, int32_t fm_index, int16_t noise, int16_t* out_L, int16_t* out_R) {
+        int16_t OSC1, OSC2, OSC_SUB;
+        int16_t OSC1_L = 0, OSC1_R = 0;
+        int16_t OSC2_L = 0, OSC2_R = 0;
+        int16_t OSC_SUB_L = 0, OSC_SUB_R = 0;
+        int16_t RM_L, RM_R;
+
+        // グライド中は補間中の増分で進む
+        bool glided = glide_mode && isGlided && monophonic;
+        volatile uint32_t* p_osc1_delta = glided ? &p_note->osc1_glide_delta[0] : &p_note->osc1_phase_delta[0];
+        volatile uint32_t* p_osc2_delta = glided ? &p_note->osc2_glide_delta[0] : &p_note->osc2_phase_delta[0];
+        uint32_t osc_sub_delta = glided ? p_note->osc_sub_glide_delta : p_note->osc_sub_phase_delta;
+        uint8_t osc1_mask = p_note->osc1_mask;
+        uint8_t osc2_mask = p_note->osc2_mask;
+
+        if(fm) {
+            renderFM(p_note, osc1_v, fm_index, true, &OSC1_L, &OSC1_R);
+            OSC1_L = (OSC1_L * (osc1_pre_level)) >> 10;
+            OSC1_R = (OSC1_R * (osc1_pre_level)) >> 10;
+        }
+        else if(osc1_wave != nullptr) {
+            if(osc1_v == 1) {
+                OSC1 = osc1_wave[((p_note->osc1_phase[0] + (p_osc1_delta[0] >> 1)) >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
+                if(osc1_panned) {
+                    OSC1_L += (OSC1 * osc1_spread_pan[0][0]) >> FIXED_SHIFT;
+                    OSC1_R += (OSC1 * osc1_spread_pan[0][1]) >> FIXED_SHIFT;
+                }
+                else {
+                    OSC1_L += OSC1;
+                    OSC1_R += OSC1;
+                }
+            }
+            else {
+                uint16_t divide = p_note->osc1_divide;
+                for(uint8_t d = 0; d < osc1_v; ++d) {
+                    if(!(osc1_mask & (1 << d))) continue; // 間引いたボイス
+                    OSC1 = ((osc1_wave[((p_note->osc1_phase[d] + (p_osc1_delta[d] >> 1)) >> BIT_SHIFT) & (SAMPLE_SIZE - 1)])*100) / divide;
+                    OSC1_L += (OSC1 * osc1_spread_pan[d][0]) >> FIXED_SHIFT; // cos
+                    OSC1_R += (OSC1 * osc1_spread_pan[d][1]) >> FIXED_SHIFT; // sin
+                }
+            }
+            OSC1_L = (OSC1_L * (osc1_pre_level)) >> 10;
+            OSC1_R = (OSC1_R * (osc1_pre_level)) >> 10;
+        }
+
+        if(osc2_wave != nullptr && !fm) {
+            if(osc2_v == 1) {
+                OSC2 = osc2_wave[((p_note->osc2_phase[0] + (p_osc2_delta[0] >> 1)) >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
+                if(osc2_panned) {
+                    OSC2_L += (OSC2 * osc2_spread_pan[0][0]) >> FIXED_SHIFT;
+                    OSC2_R += (OSC2 * osc2_spread_pan[0][1]) >> FIXED_SHIFT;
+                }
+                else {
+                    OSC2_L += OSC2;
+                    OSC2_R += OSC2;
+                }
+            }
+            else {
+                uint16_t divide = p_note->osc2_divide;
+                for(uint8_t d = 0; d < osc2_v; ++d) {
+                    if(!(osc2_mask & (1 << d))) continue; // 間引いたボイス
+                    OSC2 = ((osc2_wave[((p_note->osc2_phase[d] + (p_osc2_delta[d] >> 1)) >> BIT_SHIFT) & (SAMPLE_SIZE - 1)])*100) / divide;
+                    OSC2_L += (OSC2 * osc2_spread_pan[d][0]) >> FIXED_SHIFT; // cos
+                    OSC2_R += (OSC2 * osc2_spread_pan[d][1]) >> FIXED_SHIFT; // sin
+                }
+            }
+            OSC2_L = (OSC2_L * (osc2_pre_level)) >> 10;
+            OSC2_R = (OSC2_R * (osc2_pre_level)) >> 10;
+        }
+
+        if(osc_sub_wave != nullptr && !skip_sub) {
+            OSC_SUB = osc_sub_wave[((p_note->osc_sub_phase + (osc_sub_delta >> 1)) >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
+            if(osc_sub_panned) {
+                OSC_SUB_L = (OSC_SUB * osc_sub_pan_gain[0][0]) >> FIXED_SHIFT;
+                OSC_SUB_R = (OSC_SUB * osc_sub_pan_gain[0][1]) >> FIXED_SHIFT;
+            }
+            else {
+                OSC_SUB_L = OSC_SUB;
+                OSC_SUB_R = OSC_SUB;
+            }
+            OSC_SUB_L = (OSC_SUB_L * (osc_sub_pre_level)) >> 10;
+            OSC_SUB_R = (OSC_SUB_R * (osc_sub_pre_level)) >> 10;
+        }
+
+        // リングモジュレーション
+        if(ring_modulation) {
+            if(osc1_wave != nullptr && osc2_wave != nullptr) {
+                RM_L = (OSC1_L * OSC2_L) / 16384;
+                RM_R = (OSC1_R * OSC2_R) / 16384;
+                OSC1_L = (OSC1_L + OSC2_L) / 2;
+                OSC1_R = (OSC1_R + OSC2_R) / 2;
+                OSC2_L = RM_L;
+                OSC2_R = RM_R;
+            }
+        }
+
+        int16_t L = OSC1_L + OSC2_L + OSC_SUB_L + noise;
+        int16_t R = OSC1_R + OSC2_R + OSC_SUB_R + noise;
+        *out_L = (((L * p_note->adsr_gain) >> 10) * p_note->gain) >> 10;
+        *out_R = (((R * p_note->adsr_gain) >> 10) * p_note->gain) >> 10;
+    }
+
+    /**
+     * @brief FM用のOSC1を生成します (レベル適用前)
+     * OSC1の各ボイスはOSC2のボイスを順に割り当てて変調する (OSC2のボイス数で折り返し)
+     * 位相オフセット = OSC2 × index << FM_SHIFT (index 1000 で最大約2周期)
+     * @param mid オーバーサンプリング用の中間サンプル (位相増分の1/2先を読む)
+     */
+    void renderFM(volatile Note* p_note, uint8_t osc1_v, int32_t index, bool mid, int16_t* out_L, int16_t* out_R) {
+        int16_t OSC1;
+        int16_t OSC1_L = 0, OSC1_R = 0;
+
+        bool glided = glide_mode && isGlided && monophonic;
+        volatile uint32_t* p_osc1_delta = glided ? &p_note->osc1_glide_delta[0] : &p_note->osc1_phase_delta[0];
+        volatile uint32_t* p_osc2_delta = glided ? &p_note->osc2_glide_delta[0] : &p_note->osc2_phase_delta[0];
+        uint8_t osc1_mask = p_note->osc1_mask;
+        uint8_t osc2_v = osc2_voice;
+        uint8_t m = 0;
+
+        if(osc1_wave != nullptr) {
+            uint16_t divide = p_note->osc1_divide;
+            // 間引いたボイスも割り当てを進め、組み合わせを変えない
+            for(uint8_t d = 0; d < osc1_v; ++d, m = (m + 1 >= osc2_v) ? 0 : m + 1) {
+                if(!(osc1_mask & (1 << d))) continue;
+
+                uint32_t phase1 = p_note->osc1_phase[d];
+                uint32_t phase2 = p_note->osc2_phase[m];
+                if(mid) {
+                    phase1 += p_osc1_delta[d] >> 1;
+                    phase2 += p_osc2_delta[m] >> 1;
+                }
+
+                // 変調
+                if(osc2_wave != nullptr) {
+                    int32_t mod = osc2_wave[(phase2 >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
+                    phase1 += (uint32_t)(mod * index) << FM_SHIFT;
+                }
+
+                OSC1 = osc1_wave[(phase1 >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
+                if(osc1_v == 1) {
+                    if(osc1_panned) {
+                        OSC1_L += (OSC1 * osc1_spread_pan[0][0]) >> FIXED_SHIFT;
+                        OSC1_R += (OSC1 * osc1_spread_pan[0][1]) >> FIXED_SHIFT;
+                    }
+                    else {
+                        OSC1_L += OSC1;
+                        OSC1_R += OSC1;
+                    }
+                }
+                else {
+                    OSC1 = (OSC1 * 100) / divide;
+                    OSC1_L += (OSC1 * osc1_spread_pan[d][0]) >> FIXED_SHIFT; // cos
+                    OSC1_R += (OSC1 * osc1_spread_pan[d][1]) >> FIXED_SHIFT; // sin
+                }
+            }
+        }
+
+        *out_L = OSC1_L;
+        *out_R = OSC1_R;
+    }
+
+    /**
+     * @brief ユニゾンの間引きで生成するボイスを選びます
+     * デチューン・パンは中心に対称に並ぶため、外側から対称な組 (d, voice-1-d) を
+     * step 組毎に1組残し、音の広がりと中心を保つ (4ボイス未満は間引かない)
+     * @param count 生成するボイス数
+     * @return 生成するボイスのマスク
+     */
+    static uint8_t unisonMask(uint8_t voice, uint8_t step, uint8_t* count) {
+        uint8_t mask = 0;
+        *count = 0;
+        for(uint8_t d = 0; d < voice; ++d) {
+            uint8_t pair = (d < voice - 1 - d) ? d : voice - 1 - d;
+            if(voice < 4 || pair % step == 0) {
+                mask |= 1 << d;
+                (*count)++;
+            }
+        }
+        return mask;
+    }
+
+    /**
+     * @brief ユニゾンの間引きを設定します (step=2で半分の組を生成)
+     * 間引いたボイスも位相は進めるため、戻した時に位相が揃ったままになる
+     * @return 間引いたボイスがある場合 true
+     */
+    bool setUnisonStep(volatile Note* note, uint8_t step) {
+        uint8_t n1, n2;
+        note->unison_step = step;
+        note->osc1_mask = unisonMask(osc1_voice, step, &n1);
+        note->osc2_mask = unisonMask(osc2_voice, step, &n2);
+        note->osc1_divide = (n1 >= 2) ? DIVIDE_FIXED[n1 - 2] : 100;
+        note->osc2_divide = (n2 >= 2) ? DIVIDE_FIXED[n2 - 2] : 100;
+        return n1 < osc1_voice || n2 < osc2_voice;
+    }
+
+    // 負荷制御レベルをノートへ適用 (ブロック毎)
+    void applyGovernor() {
+        volatile Note* p_note = &notes[0];
+
+        // 音量の小さい順に半分を間引き対象にする
+        int32_t loudness[MAX_NOTES];
+        for(uint8_t n = 0; n < MAX_NOTES; ++n, ++p_note) {
+            loudness[n] = p_note->active ? p_note->adsr_gain * p_note->gain : -1;
+        }
+
+        p_note = &notes[0];
+        for(uint8_t n = 0; n < MAX_NOTES; ++n, ++p_note) {
+            uint8_t step = 1;
+            if(p_note->active) {
+                if(gov_level >= GOV_UNISON_ALL) {
+                    step = 2;
+                }
+                else if(gov_level >= GOV_UNISON_QUIET) {
+                    uint8_t louder = 0;
+                    for(uint8_t m = 0; m < MAX_NOTES; ++m) {
+                        if(loudness[m] > loudness[n] || (loudness[m] == loudness[n] && m < n)) louder++;
+                    }
+                    if(louder >= getActiveNote() / 2) step = 2;
+                }
+            }
+            if(setUnisonStep(p_note, step)) gov_reduced++;
+
+            // リリース中のノートを強制リリースへ
+            if(gov_level >= GOV_STEAL_RELEASE && p_note->active
+                && p_note->release_cnt > p_note->force_release && p_note->force_release_cnt < 0) {
+                p_note->note_off_gain = p_note->adsr_gain;
+                p_note->force_release_cnt = p_note->force_release;
+                gov_steals++;
+            }
+        }
+
+        gov_skip_sub = gov_level >= GOV_SKIP_SUB;
+        if(gov_skip_sub && osc_sub_wave != nullptr) gov_sub_skipped++;
+    }
+
+    // 発音中でなければ平滑化せず即時に反映
+    void setSmoothed(ParamSmoother& sm, int32_t value) {
+        if(!isGenerating()) sm.set(value);
+        else sm.setTarget(value);
+    }
+
+    void updatePanGain() {
+        setSmoothed(pan_gain_L_sm, (PAN_COS_TABLE[pan] * volume) >> 10);
+        setSmoothed(pan_gain_R_sm, (PAN_SIN_TABLE[pan] * volume) >> 10);
+    }
+
+    // コントロールレート処理
+    void updateControl() {
+        osc1_level = osc1_level_sm.next();
+        osc2_level = osc2_level_sm.next();
+        osc_sub_level = osc_sub_level_sm.next();
+        pan_gain_L = pan_gain_L_sm.next();
+        pan_gain_R = pan_gain_R_sm.next();
+        fm_index = fm_index_sm.next();
+        noise_level = noise_level_sm.next();
+    }
+
+    /**
+     * @brief コントロールレート1回分のノイズを生成します
+     * ピンクノイズは Paul Kellet の簡易フィルタ (3極) を整数化したもの
+     * @param os オーバーサンプリング中 (中間サンプル分も生成)
+     */
+    void fillNoise(bool os) {
+        uint8_t count = os ? CONTROL_RATE * 2 : CONTROL_RATE;
+        uint8_t type = noise_type;
+
+        for(uint8_t k = 0; k < count; ++k) {
+            int32_t white = (int32_t)noise_rng.next() >> 17; // ±16384
+            if(type == NOISE_PINK) {
+                pink_b0 += ((white * 3246) >> 15) - (pink_b0 >> 9) - (pink_b0 >> 11); // 0.99765
+                pink_b1 += ((white * 9716) >> 15) - (pink_b1 >> 5) - (pink_b1 >> 8);  // 0.963
+                pink_b2 = ((pink_b2 * 73) >> 7) + ((white * 34495) >> 15);            // 0.57
+                int32_t pink = (pink_b0 + pink_b1 + pink_b2 + ((white * 6056) >> 15)) >> 3;
+                if(pink > 16384) pink = 16384;
+                else if(pink < -16384) pink = -16384;
+                noise_buf[k] = pink;
+            }
+            else if(type == NOISE_WHITE) {
+                noise_buf[k] = white;
+            }
+            else {
+                noise_buf[k] = 0;
+            }
+        }
+    }
+
+    // カットオフの追従 (ブロック毎)
+    void updateCutoff() {
+        if(!lpf_enabled || lpf_freq == lpf_target) return;
+        float diff = lpf_target - lpf_freq;
+        if(diff < 1.0f && diff > -1.0f) lpf_freq = lpf_target;
+        else lpf_freq += diff * 0.5f;
+        lowPass(lpf_freq, lpf_q);
+    }
+
+    void requestUpdate(uint8_t flags) {
+        if(batch_update) {
+            batch_dirty |= flags;
+            return;
+        }
+        applyUpdate(flags);
+    }
+
+    void applyUpdate(uint8_t flags) {
+        if(flags & UPDATE_SPREAD_PAN) {
+            initSpreadPan();
+        }
+        if(flags & UPDATE_DETUNE) {
+            initDetuneRatio();
+        }
+        if(flags & UPDATE_LPF) {
+            lowPass(lpf_freq, lpf_q);
+        }
+        if(flags & UPDATE_HPF) {
+            highPass(hpf_freq, hpf_q);
+        }
+        if(flags & UPDATE_DELAY_RST) {
+            ringbuff_L.reset();
+            ringbuff_R.reset();
+        }
+        if((flags & UPDATE_DELAY) && delay_enabled) {
+            ringbuff_L.SetInterval(delay_sample);
+            ringbuff_R.SetInterval(delay_sample);
+        }
+    }
+
+    // 遅延線1本のサンプル数 (最大の遅延 + 1)
+    uint32_t delayLineLength() {
+        return (uint32_t)sample_rate * DELAY_MAX_MS / 1000 + 1;
+    }
+
+    /**
+     * @brief 遅延線を割り当てます (サンプリング周波数が変わった場合は割り当て直す)
+     * @return 領域が足りない場合 false
+     */
+    bool allocDelay() {
+        uint32_t length = delayLineLength();
+        if(ringbuff_L.isAttached() && ringbuff_L.getSize() == (int)length) {
+            delay_release = false;
+            return true;
+        }
+        releaseDelay();
+        if(arena == nullptr) return false;
+
+        int16_t* buff_L = (int16_t*)arena->allocate(length * sizeof(int16_t), arena_owner, ARENA_DELAY);
+        int16_t* buff_R = buff_L != nullptr ? (int16_t*)arena->allocate(length * sizeof(int16_t), arena_owner, ARENA_DELAY) : nullptr;
+        if(buff_R == nullptr) {
+            arena->release(buff_L);
+            return false;
+        }
+        ringbuff_L.attach(buff_L, length);
+        ringbuff_R.attach(buff_R, length);
+        return true;
+    }
+
+    void releaseDelay() {
+        if(arena != nullptr) {
+            arena->release(ringbuff_L.getBuffer());
+            arena->release(ringbuff_R.getBuffer());
+        }
+        ringbuff_L.detach();
+        ringbuff_R.detach();
+    }
+
+    /**
+     * @brief ユーザー波形の領域を返します (波形を切り替えた後に呼ぶ)
+     */
+    void releaseCustomShape(uint8_t osc) {
+        if(osc == 0x01 && osc1_cwave != nullptr) {
+            if(arena != nullptr) arena->release(osc1_cwave);
+            osc1_cwave = nullptr;
+        }
+        else if(osc == 0x02 && osc2_cwave != nullptr) {
+            if(arena != nullptr) arena->release(osc2_cwave);
+            osc2_cwave = nullptr;
+        }
+    }
+
     uint32_t calculate_delay_samples() {
         // フィードバックを浮動小数点数に変換（16ビット整数の最大値を1024とする）
         float feedback_ratio = (float)feedback / 1024.0f;
@@ -510,13 +1290,13 @@ private:
         float reverb_time_ms = n * (float)time;
 
         // 残響時間をサンプル数に変換
-        uint32_t reverb_samples = (uint32_t)((reverb_time_ms / 1000.0f) * (float)SAMPLE_RATE);
+        uint32_t reverb_samples = (uint32_t)((reverb_time_ms / 1000.0f) * (float)sample_rate);
 
         return reverb_samples;
     }
 
 public:
-    WaveGenerator(int32_t rate): SAMPLE_RATE(rate) {
+    WaveGenerator(int32_t rate): sample_rate(rate) {
         noteReset();
         for(uint8_t i = 0; i < MAX_NOTES; i++) {
             cache[i].processed = true;
@@ -524,8 +1304,104 @@ public:
             cache[i].velocity = 0;
         }
         initSpreadPan();
+        initPitchTable();
+        initDetuneRatio();
         lowPass(1000.0f, 1.0f/sqrt(2.0f));
         highPass(500.0f, 1.0f/sqrt(2.0f));
+        initPatch();
+    }
+
+    /**
+     * @brief 同時発音数の上限を設定します
+     * 上限に達すると最も古いノートを入れ替える (発音中のノートはそのまま)
+     * @param limit 1 ~ MAX_NOTES
+     */
+    void setNoteLimit(uint8_t limit) {
+        if(limit > MAX_NOTES) limit = MAX_NOTES;
+        else if(limit < 1) limit = 1;
+        note_limit = limit;
+    }
+
+    // 強制リリース中を除いた発音数
+    uint8_t getSoundingNote() {
+        uint8_t sounding = 0;
+        volatile Note* p_note = &notes[0];
+
+        for(uint8_t i = 0; i < MAX_NOTES; ++i, ++p_note) {
+            if(p_note->active && p_note->force_release_cnt < 0) sounding++;
+        }
+        return sounding;
+    }
+
+    /**
+     * @brief 最も古いノートを強制リリースします (他パートへ発音数を譲る)
+     * @return 停止したノートがある場合 true
+     */
+    bool releaseOldest() {
+        int8_t index = -1;
+        int8_t min = INT8_MAX;
+        volatile Note* p_note = &notes[0];
+
+        for(uint8_t i = 0; i < MAX_NOTES; ++i, ++p_note) {
+            if(!p_note->active || p_note->force_release_cnt >= 0) continue;
+            if(p_note->actnum < min) {
+                min = p_note->actnum;
+                index = i;
+            }
+        }
+        if(index == -1) return false;
+
+        notes[index].note_off_gain = notes[index].adsr_gain;
+        notes[index].force_release_cnt = force_release_sample;
+        notes[index].attack_cnt = -1;
+        notes[index].decay_cnt = -1;
+        return true;
+    }
+
+    static uint8_t getMaxNotes() {
+        return MAX_NOTES;
+    }
+
+    /**
+     * @brief ノートの状態を取得します (発音の振り分け用)
+     * @param index 0 ~ getMaxNotes()-1
+     * @param note 出力: ノート番号
+     * @param level 出力: エンベロープの音量 0~1024
+     * @param age 出力: 発音順 (0が最も古い)
+     * @return エンベロープの段階 (ENV_IDLE: 空き)
+     */
+    uint8_t getNoteState(uint8_t index, uint8_t* note, uint16_t* level, uint8_t* age) {
+        if(index >= MAX_NOTES || !notes[index].active) return ENV_IDLE;
+        volatile Note* p_note = &notes[index];
+
+        *note = p_note->note;
+        *level = p_note->adsr_gain;
+        *age = p_note->actnum < 0 ? 0 : p_note->actnum;
+
+        // generate() と同じ優先順
+        if(p_note->attack_cnt >= 0) return ENV_ATTACK;
+        if(p_note->force_release_cnt >= 0) return ENV_FORCE_RELEASE;
+        if(p_note->release_cnt >= 0) return ENV_RELEASE;
+        if(p_note->decay_cnt >= 0) return ENV_DECAY;
+        return ENV_SUSTAIN;
+    }
+
+    /**
+     * @brief 発音数が上限のときに次のノートオンで入れ替えるノート
+     * @return ノートのインデックス (-1: 発音なし)
+     */
+    int8_t getStealCandidate() {
+        int8_t index = -1;
+        int8_t min = INT8_MAX;
+        volatile Note* p_note = &notes[0];
+
+        for(uint8_t i = 0; i < MAX_NOTES; ++i, ++p_note) {
+            if(p_note->active && p_note->actnum < min) {
+                min = p_note->actnum;
+                index = i;
+            }
+        }
+        return index;
     }
 
     uint8_t getActiveNote() {
@@ -538,6 +1414,36 @@ public:
         return active;
     }
 
+    /**
+     * @brief 生成しているボイス数を取得します (ユニゾンの間引き後, フェード中を含む)
+     * 負荷の見積もり用
+     */
+    uint8_t getVoiceCount() {
+        uint8_t count = 0;
+        volatile Note* p_note = &notes[0];
+
+        for(uint8_t i = 0; i < NOTE_SLOTS; ++i, ++p_note) {
+            if(!p_note->active) continue;
+            if(osc1_wave != nullptr) count += __builtin_popcount(p_note->osc1_mask & ((1 << osc1_voice) - 1));
+            if(osc2_wave != nullptr) count += __builtin_popcount(p_note->osc2_mask & ((1 << osc2_voice) - 1));
+            if(osc_sub_wave != nullptr && !gov_skip_sub) count++;
+        }
+        return count;
+    }
+
+    /**
+     * @brief 生成が必要か (入れ替えたノートのフェード中を含む)
+     * getActiveNote() はフェード用スロットを数えないため、生成の要否はこちらで判定する
+     */
+    bool isGenerating() {
+        volatile Note* p_note = &notes[0];
+
+        for(uint8_t i = 0; i < NOTE_SLOTS; ++i, ++p_note) {
+            if(p_note->active == true) return true;
+        }
+        return false;
+    }
+
     bool isNote(uint8_t note) {
         int8_t i = getNoteIndex(note);
         if(i == -1) return false;
@@ -563,9 +1469,22 @@ public:
         }
         else {
             i = 0;
+            if(legato && !isCache) {
+                pushHeld(note);
+                // 押鍵が重なった場合は強制リリースを経ずに音程だけ切り替える
+                if(isMonoSounding()) {
+                    retargetNote(note);
+                    return;
+                }
+            }
         }
         if(i == -1) return;
 
+        // 空きがあればフェード用スロットで止め、新しいノートは直ちに発音
+        if(notes[i].active && !isCache && !monophonic) {
+            moveToFade(i);
+        }
+
         if(notes[i].active && !isCache) {
 
             // 強制停止専用release
@@ -582,10 +1501,8 @@ public:
             return;
         }
 
-        // core1でフェーズ計算
-        /*core1*/ calc_i = i;
-        /*core1*/ calc_note = note;
-        /*core1*/ calc_mode = CALC_SET_F;
+        // 位相増分 (テーブル参照のみのためcore0で計算)
+        setFrequency(i, note);
 
         // AMP ADSR
         notes[i].attack_cnt = 0;
@@ -603,6 +1520,7 @@ public:
 
         notes[i].release_cnt = -1;
         notes[i].force_release_cnt = -1;
+        setUnisonStep(&notes[i], 1);
         notes[i].note = note;
         notes[i].gain = ((amp_gain / MAX_NOTES) * ((velocity << 10) / 127)) >> 10;
 
@@ -619,13 +1537,22 @@ public:
         else if(newActNum == -1) newActNum = 0;
         notes[i].actnum = newActNum;
 
-        // core1を待つ
-        while(calc_mode == CALC_SET_F);
+        // 次に生成されるサンプルから発音 (アタック初回はゲイン0のため+1)
+        notes[i].start_index = render_index + 2;
+        notes[i].started = true;
 
         notes[i].active = true;
     }
 
     void noteOff(uint8_t note) {
+        // レガート: 鳴っているノートを離した場合は押鍵中の直前のノートへ戻る
+        if(legato && removeHeld(note) && held_count > 0) {
+            if(notes[0].note == note && isMonoSounding()) {
+                retargetNote(held_notes[held_count - 1]);
+                return;
+            }
+        }
+
         // cache にある場合は消す
         NoteCache* p_cache = &cache[0];
         for(uint8_t n = 0; n < MAX_NOTES; ++n, ++p_cache) {
@@ -649,8 +1576,9 @@ public:
 
     void noteReset() {
         volatile Note* p_note = &notes[0];
+        held_count = 0;
 
-        for(uint8_t i = 0; i < MAX_NOTES; ++i, ++p_note) {
+        for(uint8_t i = 0; i < NOTE_SLOTS; ++i, ++p_note) {
             resetPhase(i);
             resetPhaseDelta(i);
             p_note->active = false;
@@ -663,6 +1591,8 @@ public:
             p_note->decay_cnt = -1;
             p_note->release_cnt = -1;
             p_note->force_release_cnt = -1;
+            p_note->started = false;
+            setUnisonStep(p_note, 1);
 
             p_note->level_diff = level_diff;
             p_note->sustain = sustain_level;
@@ -708,7 +1638,12 @@ public:
                     osc_sub_wave = nullptr;
                 }
                 break;
+            default:
+                return;
         }
+        if(osc >= 0x01 && osc <= 0x03) patch.shape[osc - 1] = id;
+        if(id == 0xff && osc >= 0x01 && osc <= 0x02) patch.voice[osc - 1] = 1;
+        releaseCustomShape(osc);
     }
 
     void setAttack(int16_t attack) {
@@ -716,7 +1651,8 @@ public:
         else if(attack < 0) attack = 0;
 
         // in1000 = out1024, in500 = out512
-        attack_sample = (((attack << 10) / 1000) * SAMPLE_RATE) >> 10;
+        attack_sample = (((attack << 10) / 1000) * sample_rate) >> 10;
+        patch.attack = attack;
     }
 
     void setRelease(int16_t release) {
@@ -724,7 +1660,8 @@ public:
         else if(release < 0) release = 0;
 
         // in1000 = out1024, in500 = out512
-        release_sample = (((release << 10) / 1000) * SAMPLE_RATE) >> 10;
+        release_sample = (((release << 10) / 1000) * sample_rate) >> 10;
+        patch.release = release;
     }
 
     void setDecay(int16_t decay) {
@@ -732,7 +1669,8 @@ public:
         else if(decay < 0) decay = 0;
 
         // in1000 = out1024, in500 = out512
-        decay_sample = (((decay << 10) / 1000) * SAMPLE_RATE) >> 10;
+        decay_sample = (((decay << 10) / 1000) * sample_rate) >> 10;
+        patch.decay = decay;
     }
 
     void setSustain(int16_t sustain) {
@@ -741,6 +1679,7 @@ public:
 
         sustain_level = (sustain << 10) / 1000; // in1000 = out1024, in500 = out512
         level_diff = 1024 - sustain_level;
+        patch.sustain = sustain;
     }
 
     void setVoice(uint8_t voice, uint8_t osc) {
@@ -752,7 +1691,16 @@ public:
             else if(osc == 2) {
                 osc2_voice = voice;
             }
-            initSpreadPan();
+            if(osc == 1 || osc == 2) patch.voice[osc - 1] = voice;
+            requestUpdate(UPDATE_SPREAD_PAN | UPDATE_DETUNE);
+            if(osc == 1) retune_flags |= RETUNE_OSC1_DETUNE;
+            else if(osc == 2) retune_flags |= RETUNE_OSC2_DETUNE;
+
+            // 発音中ノートの間引き設定を更新
+            volatile Note* p_note = &notes[0];
+            for(uint8_t n = 0; n < NOTE_SLOTS; ++n, ++p_note) {
+                setUnisonStep(p_note, p_note->unison_step);
+            }
         }
     }
 
@@ -764,7 +1712,10 @@ public:
         else if(osc == 2) {
             osc2_detune = detune / 100.0f;
         }
-        initSpreadPan();
+        if(osc == 1 || osc == 2) patch.detune[osc - 1] = detune;
+        requestUpdate(UPDATE_DETUNE);
+        if(osc == 1) retune_flags |= RETUNE_OSC1_DETUNE;
+        else if(osc == 2) retune_flags |= RETUNE_OSC2_DETUNE;
     }
 
     void setSpread(uint8_t spread, uint8_t osc) {
@@ -775,19 +1726,36 @@ public:
         else if(osc == 2) {
             osc2_spread = spread;
         }
-        initSpreadPan();
+        if(osc == 1 || osc == 2) patch.spread[osc - 1] = spread;
+        requestUpdate(UPDATE_SPREAD_PAN);
     }
 
-    void setCustomShape(int16_t *wave, uint8_t osc) {
-        if(!canSetVoice(osc, 1, true, 0x00)) return;
+    /**
+     * @brief ユーザー波形を設定します (初回に SramArena から領域を割り当てる)
+     * @return 領域が足りない場合 false
+     */
+    bool setCustomShape(const int16_t *wave, uint8_t osc) {
+        if(osc != 1 && osc != 2) return false;
+        if(!canSetVoice(osc, 1, true, 0x00)) return false;
+
+        int16_t* table = (osc == 1) ? osc1_cwave : osc2_cwave;
+        if(table == nullptr) {
+            if(arena == nullptr) return false;
+            table = (int16_t*)arena->allocate(SAMPLE_SIZE * sizeof(int16_t), arena_owner, ARENA_WAVE);
+            if(table == nullptr) return false;
+        }
+
+        memcpy(table, wave, SAMPLE_SIZE * sizeof(int16_t));
         if(osc == 1) {
-            memcpy(osc1_cwave, wave, 2048 * sizeof(int16_t));
+            osc1_cwave = table;
             osc1_wave = osc1_cwave;
         }
-        else if(osc == 2) {
-            memcpy(osc2_cwave, wave, 2048 * sizeof(int16_t));
+        else {
+            osc2_cwave = table;
             osc2_wave = osc2_cwave;
         }
+        patch.shape[osc - 1] = PATCH_SHAPE_CUSTOM;
+        return true;
     }
 
     void setLowPassFilter(bool enable, float freq = 1000.0f, float q = 1.0f/sqrt(2.0f)){
@@ -796,8 +1764,18 @@ public:
         if(q < 0.02f) q = 0.02f;
         else if(q > 40.0f) q = 40.0f;
 
+        // 発音中のカットオフ変更はブロック毎に追従させる
+        bool smooth = lpf_enabled && enable && isGenerating();
         lpf_enabled = enable;
-        if(lpf_enabled) lowPass(freq, q);
+        if(lpf_enabled) {
+            lpf_target = freq;
+            if(!smooth) lpf_freq = freq;
+            lpf_q = q;
+            requestUpdate(UPDATE_LPF);
+        }
+        patch.lpf_enabled = enable;
+        patch.lpf_freq = freq;
+        patch.lpf_q = q;
     }
 
     void setHighPassFilter(bool enable, float freq = 500.0f, float q = 1.0f/sqrt(2.0f)){
@@ -807,7 +1785,14 @@ public:
         else if(q > 40.0f) q = 40.0f;
 
         hpf_enabled = enable;
-        if(hpf_enabled) highPass(freq, q);
+        if(hpf_enabled) {
+            hpf_freq = freq;
+            hpf_q = q;
+            requestUpdate(UPDATE_HPF);
+        }
+        patch.hpf_enabled = enable;
+        patch.hpf_freq = freq;
+        patch.hpf_q = q;
     }
 
     void setOscLevel(uint8_t osc, int16_t level) {
@@ -815,18 +1800,40 @@ public:
         else if(level < 0) level = 0;
 
         if(osc == 0x01) {
-            osc1_level = (level << 10) / 1000; // in1000 = out1024, in500 = out512
+            setSmoothed(osc1_level_sm, (level << 10) / 1000); // in1000 = out1024, in500 = out512
         }
         else if(osc == 0x02) {
-            osc2_level = (level << 10) / 1000; // in1000 = out1024, in500 = out512
+            setSmoothed(osc2_level_sm, (level << 10) / 1000); // in1000 = out1024, in500 = out512
         }
         else if(osc == 0x03) {
-            osc_sub_level = (level << 10) / 1000; // in1000 = out1024, in500 = out512
+            setSmoothed(osc_sub_level_sm, (level << 10) / 1000); // in1000 = out1024, in500 = out512
         }
+        if(!isGenerating()) updateControl();
+        if(osc >= 0x01 && osc <= 0x03) patch.osc_level[osc - 1] = level;
     }
 
+    /**
+     * @brief OSCごとのパンを設定します
+     * スプレッドのゲインテーブルに含めるため、サンプル毎の処理は増えません
+     * @param pan 0=L, 50=C, 100=R
+     */
     void setOscPan(uint8_t osc, uint8_t pan) {
-        //
+        if(pan > 100) pan = 100;
+
+        if(osc == 0x01) {
+            osc1_pan = pan;
+        }
+        else if(osc == 0x02) {
+            osc2_pan = pan;
+        }
+        else if(osc == 0x03) {
+            osc_sub_pan = pan;
+        }
+        else {
+            return;
+        }
+        patch.osc_pan[osc - 1] = pan;
+        requestUpdate(UPDATE_SPREAD_PAN);
     }
 
     void setOscOctave(uint8_t osc, int8_t octave) {
@@ -842,6 +1849,8 @@ public:
         else if(osc == 0x03) {
             osc_sub_oct = octave;
         }
+        if(osc >= 0x01 && osc <= 0x03) patch.osc_oct[osc - 1] = octave;
+        retune_flags |= retuneFlag(osc);
     }
 
     void setOscSemitone(uint8_t osc, int8_t semitone) {
@@ -857,6 +1866,8 @@ public:
         else if(osc == 0x03) {
             osc_sub_semi = semitone;
         }
+        if(osc >= 0x01 && osc <= 0x03) patch.osc_semi[osc - 1] = semitone;
+        retune_flags |= retuneFlag(osc);
     }
 
     void setOscCent(uint8_t osc, int8_t cent) {
@@ -872,6 +1883,8 @@ public:
         else if(osc == 0x03) {
             osc_sub_cent = cent;
         }
+        if(osc >= 0x01 && osc <= 0x03) patch.osc_cent[osc - 1] = cent;
+        retune_flags |= retuneFlag(osc);
     }
 
     void setAmpLevel(int16_t level) {
@@ -879,57 +1892,281 @@ public:
         else if(level < 0) level = 0;
 
         amp_gain = (level << 10) / 1000; // in1000 = out1024, in500 = out512
+        patch.amp_level = level;
     }
 
     void setAmpPan(uint8_t pan) {
         if(pan > 100) pan = 100;
         else if(pan < 0) pan = 0;
         this->pan = pan;
+        patch.amp_pan = pan;
+        updatePanGain();
+        if(!isGenerating()) updateControl();
+    }
+
+    /**
+     * @brief サンプルレートを変更します
+     * 発音中のノートは停止し、サンプル数で持つ値 (エンベロープ・ディレイ・フィルタ係数・位相増分) を再計算する
+     * @param rate 8000 ~ 48000 (ディレイのリングバッファが48kHz基準のため)
+     */
+    void setSampleRate(int32_t rate) {
+        if(rate > 48000) rate = 48000;
+        else if(rate < 8000) rate = 8000;
+        if(rate == sample_rate) return;
+
+        noteReset();
+        sample_rate = rate;
+        initPitchTable();
+
+        // エンベロープ
+        setAttack(patch.attack);
+        setDecay(patch.decay);
+        setRelease(patch.release);
+        force_release_sample = (10 * sample_rate) >> 10;
+
+        // ディレイ (残響は破棄する)
+        setDelay(patch.delay_enabled, patch.delay_time, patch.delay_level, patch.delay_feedback);
+        requestUpdate(UPDATE_LPF | UPDATE_HPF | UPDATE_DELAY_RST | UPDATE_DELAY);
+
+        decimator_L.reset();
+        decimator_R.reset();
+    }
+
+    int32_t getSampleRate() {
+        return sample_rate;
+    }
+
+    /**
+     * @brief 2倍オーバーサンプリングを設定します (次のブロックから適用)
+     * 波形生成とリングモジュレーションを2倍のレートで行い、ハーフバンドフィルタで間引く
+     */
+    void setOversampling(bool enable) {
+        oversampling = enable;
+        patch.oversample = enable;
+    }
+
+    bool isOversampling() {
+        return oversampling;
+    }
+
+    /**
+     * @brief 負荷制御レベルを設定します (次のブロックから適用)
+     * @param level GOV_NORMAL ~ GOV_LEVEL_MAX
+     */
+    void setGovernorLevel(uint8_t level) {
+        gov_level = level > GOV_LEVEL_MAX ? GOV_LEVEL_MAX : level;
+    }
+
+    /**
+     * @brief 負荷制御の実績を取得します
+     * @param counts {早期停止ノート数, ユニゾン間引きノート×ブロック数, サブOSC省略ブロック数}
+     */
+    void getGovernorCounts(uint32_t* counts) {
+        counts[0] = gov_steals;
+        counts[1] = gov_reduced;
+        counts[2] = gov_sub_skipped;
+    }
+
+    void resetGovernorCounts() {
+        gov_steals = 0;
+        gov_reduced = 0;
+        gov_sub_skipped = 0;
+    }
+
+    /**
+     * @brief ピッチベンドを設定します
+     * 発音中のノートには次のコントロールレート処理で反映されます
+     * @param bend -8192 ~ 8191
+     */
+    void setPitchBend(int16_t bend) {
+        if(bend > 8191) bend = 8191;
+        else if(bend < -8192) bend = -8192;
+        bend_cent = ((int32_t)bend * BEND_RANGE) / 8192;
+        retune_flags |= RETUNE_PITCH;
+    }
+
+    /**
+     * @brief MIDI CCでパラメータを変更します
+     * 連続値はコントロールレートで平滑化されます
+     */
+    void controlChange(uint8_t cc, uint8_t value) {
+        if(value > 127) value = 127;
+        switch(cc) {
+            case CC_VOLUME:
+                volume = (value << 10) / 127;
+                updatePanGain();
+                if(!isGenerating()) updateControl();
+                break;
+            case CC_PAN:
+                setAmpPan((value * 100) / 127);
+                break;
+            case CC_OSC1_LEVEL:
+                setOscLevel(0x01, (value * 1000) / 127);
+                break;
+            case CC_OSC2_LEVEL:
+                setOscLevel(0x02, (value * 1000) / 127);
+                break;
+            case CC_SUB_LEVEL:
+                setOscLevel(0x03, (value * 1000) / 127);
+                break;
+            case CC_FM_INDEX:
+                setFmIndex((value * 1000) / 127);
+                break;
+            case CC_LEGATO:
+                if(monophonic) setMonophonic(true, value >= 64);
+                break;
+            case CC_CUTOFF:
+                // 20Hz ~ 20kHz (指数カーブ)
+                if(lpf_enabled) setLowPassFilter(true, 20.0f * pow(1000.0f, value / 127.0f), lpf_q);
+                break;
+            case CC_ALL_NOTES_OFF:
+                allNotesOff();
+                break;
+        }
+    }
+
+    /**
+     * @brief 鳴っている全てのノートをリリースします
+     * SYNTH_SOUND_STOP と異なりリリースを経て止まる
+     */
+    void allNotesOff() {
+        // レガートで戻る先を残さない
+        held_count = 0;
+
+        // 発音待ちのノートも破棄
+        for(uint8_t n = 0; n < MAX_NOTES; ++n) cache[n].processed = true;
+
+        volatile Note* p_note = &notes[0];
+        for(uint8_t i = 0; i < MAX_NOTES; ++i, ++p_note) {
+            if(p_note->active && p_note->release_cnt < 0 && p_note->force_release_cnt < 0) noteOff(p_note->note);
+        }
     }
 
-    void setDelay(bool enable, int16_t time = 250, int16_t level = 300, int16_t feedback = 500) {
+    /**
+     * @brief ディレイを設定します (有効にした時に遅延線を割り当て、無効にすると返す)
+     * @return 遅延線の領域が足りない場合 false (ディレイは無効になる)
+     */
+    bool setDelay(bool enable, int16_t time = 250, int16_t level = 300, int16_t feedback = 500) {
         if(time < 10) time = 10;
-        else if(time > 300) time = 300;
+        else if(time > DELAY_MAX_MS) time = DELAY_MAX_MS;
         if(feedback > 900) feedback = 900;
         else if(feedback < 0) feedback = 0;
         if(level > 1000) level = 1000;
         else if(level < 0) level = 0;
 
+        // 遅延線 (割り当てられない場合は無効のまま)
+        bool allocated = !enable || allocDelay();
+        if(!allocated) enable = false;
+
         delay_enabled = enable;
         if(delay_enabled) {
             this->time = time;
             this->level = (level << 10) / 1000;
             this->feedback = (feedback << 10) / 1000;
-            int delay_sample = SAMPLE_RATE * this->time / 1000;
+            delay_sample = sample_rate * this->time / 1000;
             delay_long = calculate_delay_samples();
-            ringbuff_L.SetInterval(delay_sample);
-            ringbuff_R.SetInterval(delay_sample);
+            requestUpdate(UPDATE_DELAY);
         }
         else {
             delay_long = 0;
-            ringbuff_L.reset();
-            ringbuff_R.reset();
+            requestUpdate(UPDATE_DELAY_RST);
+            // 生成中に割り込みから無効にされる場合があるため、領域は releasePending() で返す
+            delay_release = true;
         }
+        patch.delay_enabled = enable;
+        patch.delay_time = time;
+        patch.delay_level = level;
+        patch.delay_feedback = feedback;
+        return allocated;
     }
 
     void setMod(uint8_t mod) {
         switch (mod) {
             case 0x00:
                 ring_modulation = false;
+                fm_modulation = false;
                 break;
 
             case 0x01:
                 ring_modulation = true;
+                fm_modulation = false;
+                break;
+
+            case 0x02:
+                ring_modulation = false;
+                fm_modulation = true;
                 break;
+
+            default:
+                return;
+        }
+        patch.mod = mod;
+    }
+
+    /**
+     * @brief FMの変調量を設定します (コントロールレートで追従)
+     * @param index 0 ~ 1000
+     */
+    void setFmIndex(int16_t index) {
+        if(index > 1000) index = 1000;
+        else if(index < 0) index = 0;
+        setSmoothed(fm_index_sm, index);
+        patch.fm_index = index;
+    }
+
+    /**
+     * @brief ノイズOSCの種類を設定します
+     * @param type NOISE_OFF / NOISE_WHITE / NOISE_PINK
+     */
+    void setNoise(uint8_t type) {
+        if(type > NOISE_PINK) return;
+        if(type != noise_type) {
+            pink_b0 = 0;
+            pink_b1 = 0;
+            pink_b2 = 0;
         }
+        noise_type = type;
+        patch.noise_type = type;
+    }
+
+    /**
+     * @brief ノイズOSCのレベルを設定します (コントロールレートで追従)
+     * @param level 0 ~ 1000
+     */
+    void setNoiseLevel(int16_t level) {
+        if(level > 1000) level = 1000;
+        else if(level < 0) level = 0;
+        setSmoothed(noise_level_sm, (level << 10) / 1000); // in1000 = out1024, in500 = out512
+        if(!isGenerating()) updateControl();
+        patch.noise_level = level;
+    }
+
+    /**
+     * @brief 乱数の種を設定します (位相・ノイズの再現用)
+     */
+    void setSeed(uint32_t seed) {
+        phase_rng.seed(seed);
+        noise_rng.seed(seed ^ 0x9E3779B9);
+        pink_b0 = 0;
+        pink_b1 = 0;
+        pink_b2 = 0;
     }
 
-    void setMonophonic(bool enable) {
+    /**
+     * @brief モノフォニックを設定します
+     * @param legato_mode 押鍵が重なったノートはエンベロープを続けたまま音程のみ切り替える
+     */
+    void setMonophonic(bool enable, bool legato_mode = false) {
         monophonic = enable;
+        legato = enable && legato_mode;
+        held_count = 0;
         if(!enable) {
             glide_mode = false;
             isGlided = false;
+            patch.glide_enabled = false;
         }
+        patch.monophonic = enable;
+        patch.legato = legato;
     }
 
     void setGlideMode(bool enable, uint16_t time = 15) {
@@ -939,10 +2176,13 @@ public:
             glide_mode = true;
             isGlided = false;
             glide_time = time;
+            patch.glide_enabled = true;
+            patch.glide_time = time;
         }
         else if(!enable) {
             glide_mode = false;
             isGlided = false;
+            patch.glide_enabled = false;
         }
     }
 
@@ -950,10 +2190,32 @@ public:
         return delay_enabled;
     }
 
+    /**
+     * @brief 遅延線・ユーザー波形を割り当てる領域を設定します
+     * 設定するまでディレイとユーザー波形は使えない
+     * @param owner 所有者 (パート番号)
+     */
+    void setArena(SramArena* memory, uint8_t owner) {
+        arena = memory;
+        arena_owner = owner;
+    }
+
     uint32_t* getDelayLong() {
         return &delay_long;
     }
 
+    /**
+     * @brief 発音していない間のディレイの残響を1ブロック分生成します
+     * @param frames 出力先 (FRAME_PACK)
+     */
+    void generateTail(uint32_t* frames, size_t size) {
+        for(size_t i = 0; i < size; ++i) {
+            int16_t L = delayProcess(0, 0x00);
+            int16_t R = delayProcess(0, 0x01);
+            frames[i] = FRAME_PACK(L, R);
+        }
+    }
+
     int16_t delayProcess(int16_t in, uint8_t lr) {
         int16_t tmp;
 
@@ -979,6 +2241,122 @@ public:
         return tmp;
     }
 
+    /**
+     * @brief バッチ更新を開始します
+     * endUpdateまで派生値(スプレッドパン、フィルタ係数、ディレイ)の計算を遅延します
+     */
+    void beginUpdate() {
+        batch_update = true;
+        batch_dirty = 0x00;
+    }
+
+    /**
+     * @brief バッチ更新を終了し、派生値を一度だけ計算します
+     */
+    void endUpdate() {
+        batch_update = false;
+        applyUpdate(batch_dirty);
+        batch_dirty = 0x00;
+    }
+
+    /**
+     * @brief 現在のパラメータを取得します
+     */
+    const Patch& getPatch() {
+        return patch;
+    }
+
+    /**
+     * @brief ユーザー波形のテーブルを取得します
+     * @return 割り当てていない場合 nullptr
+     */
+    const int16_t* getCustomShape(uint8_t osc) {
+        if(osc == 0x01) return osc1_cwave;
+        if(osc == 0x02) return osc2_cwave;
+        return nullptr;
+    }
+
+    /**
+     * @brief パラメータ一式を適用します
+     * 派生値の計算は最後に一度だけ行われます
+     * 現在の遅延線をその場で返すため、ブロック境界で呼びます
+     * @param osc1_table ユーザー波形 (shapeがPATCH_SHAPE_CUSTOMの場合)
+     * @param osc2_table ユーザー波形 (shapeがPATCH_SHAPE_CUSTOMの場合)
+     * @return 適用しなかった場合、または領域が足りず一部を適用できなかった場合 false
+     */
+    bool setPatch(const Patch& p, const int16_t* osc1_table = nullptr, const int16_t* osc2_table = nullptr) {
+        if(p.magic != PATCH_MAGIC || p.version > PATCH_VERSION) return false;
+
+        // 必要な領域 (割り当てる順) が収まらないパッチは適用しない
+        // 現在のユーザー波形・遅延線は resetParam() で返すため空きとみなす
+        uint32_t sizes[4];
+        uint8_t n = 0;
+        if(p.shape[0] == PATCH_SHAPE_CUSTOM && osc1_table != nullptr) sizes[n++] = SAMPLE_SIZE * sizeof(int16_t);
+        if(p.shape[1] == PATCH_SHAPE_CUSTOM && osc2_table != nullptr) sizes[n++] = SAMPLE_SIZE * sizeof(int16_t);
+        if(p.delay_enabled) {
+            sizes[n++] = delayLineLength() * sizeof(int16_t);
+            sizes[n++] = delayLineLength() * sizeof(int16_t);
+        }
+        if(n > 0 && (arena == nullptr || !arena->canFit(sizes, n, arena_owner))) return false;
+
+        bool batch = batch_update;
+        if(!batch) beginUpdate();
+
+        setMonophonic(p.monophonic, p.version >= 0x05 && p.legato);
+        resetParam();
+        // 無効にした遅延線を先に返す (canFit() で空きとみなした領域)
+        releasePending();
+
+        bool applied = true;
+
+        // 波形 (ボイス数の確認があるため先に設定)
+        const int16_t* tables[2] = {osc1_table, osc2_table};
+        for(uint8_t osc = 0x01; osc <= 0x03; ++osc) {
+            uint8_t id = p.shape[osc - 1];
+            if(id == PATCH_SHAPE_CUSTOM) {
+                if(osc <= 0x02 && tables[osc - 1] != nullptr && !setCustomShape(tables[osc - 1], osc)) applied = false;
+            }
+            else if(id != PATCH_SHAPE_NONE) {
+                setShape(id, osc);
+            }
+        }
+
+        setAttack(p.attack);
+        setDecay(p.decay);
+        setSustain(p.sustain);
+        setRelease(p.release);
+
+        for(uint8_t osc = 0x01; osc <= 0x02; ++osc) {
+            setVoice(p.voice[osc - 1], osc);
+            setDetune(p.detune[osc - 1], osc);
+            setSpread(p.spread[osc - 1], osc);
+        }
+        for(uint8_t osc = 0x01; osc <= 0x03; ++osc) {
+            setOscLevel(osc, p.osc_level[osc - 1]);
+            setOscPan(osc, p.osc_pan[osc - 1]);
+            setOscOctave(osc, p.osc_oct[osc - 1]);
+            setOscSemitone(osc, p.osc_semi[osc - 1]);
+            setOscCent(osc, p.osc_cent[osc - 1]);
+        }
+
+        setAmpLevel(p.amp_level);
+        setAmpPan(p.amp_pan);
+        setLowPassFilter(p.lpf_enabled, p.lpf_freq, p.lpf_q);
+        setHighPassFilter(p.hpf_enabled, p.hpf_freq, p.hpf_q);
+        if(!setDelay(p.delay_enabled, p.delay_time, p.delay_level, p.delay_feedback)) applied = false;
+        setMod(p.mod);
+        setGlideMode(p.glide_enabled, p.glide_time);
+        if(p.version >= 0x02) setOversampling(p.oversample);
+        if(p.version >= 0x03) setFmIndex(p.fm_index);
+        if(p.version >= 0x04) {
+            setNoise(p.noise_type);
+            setNoiseLevel(p.noise_level);
+        }
+
+        if(!batch) endUpdate();
+        return applied;
+    }
+
     /**
      * @brief シンセのパラメータをリセットします
      */
@@ -1027,9 +2405,66 @@ public:
         setMod(0x00);
         // Glideリセット（monophonicはここではリセットしない）
         setGlideMode(false);
+        // オーバーサンプリングリセット
+        setOversampling(false);
+        // FMリセット
+        setFmIndex(0);
+        // ノイズリセット
+        setNoise(NOISE_OFF);
+        setNoiseLevel(1000);
+    }
+
+    /**
+     * @brief 1ブロック分の波形を生成します
+     * @param frames 出力先 (FRAME_PACKのステレオフレーム, I2Sへそのまま渡せる)
+     * @param size フレーム数
+     */
+    void generate(uint32_t *frames, size_t size) {
+        releasePending();
+        beginBlock();
+        generateSpan(frames, 0, size);
+        endBlock(size);
+    }
+
+    /**
+     * @brief 無効にしたディレイの遅延線を SramArena へ返します
+     * 生成中のブロックが使い終わった後 (ブロック境界) に呼ぶ
+     * 本体では割り込みを止めて呼ぶ (I2C割り込みからの割り当てと競合しないよう)
+     */
+    void releasePending() {
+        if(!delay_release) return;
+        delay_release = false;
+        if(!delay_enabled) releaseDelay();
+    }
+
+    /**
+     * @brief ブロックの生成を開始します
+     * 命令の位置でブロックを区切る場合は beginBlock() → generateSpan() ... → endBlock() の順に呼ぶ
+     */
+    void beginBlock() {
+        // 負荷制御の適用
+        applyGovernor();
+
+        // オーバーサンプリングの切り替え
+        if(oversampling != os_active) {
+            decimator_L.reset();
+            decimator_R.reset();
+            os_active = oversampling;
+        }
+
+        // カットオフの追従
+        updateCutoff();
     }
 
-    void generate(int16_t *buffer_L, int16_t *buffer_R, size_t size) {
+    /**
+     * @brief ブロックの一部を生成します
+     * コントロールレートはブロック内の位置で数えるため、区切り方によらず出力は同じ
+     * 区切りの間に適用した命令は offset のサンプルから反映される
+     * @param frames ブロックの先頭
+     * @param offset 生成を始めるブロック内の位置
+     * @param size フレーム数
+     */
+    void generateSpan(uint32_t *frames, size_t offset, size_t size) {
 
         // ローカル変数用
         uint8_t d;
@@ -1039,8 +2474,11 @@ public:
         int16_t OSC_SUB_L, OSC_SUB_R;
         int16_t L, RM_L;
         int16_t R, RM_R;
-        int16_t osc1_pre_level, osc2_pre_level, osc_sub_pre_level;
+        int16_t out_L, out_R;
+        int16_t osc1_pre_level = 0, osc2_pre_level = 0, osc_sub_pre_level = 0;
+        int16_t NOISE = 0, NOISE_MID = 0;
         int32_t adsr_gain;
+        uint8_t osc1_mask, osc2_mask;
 
         // 配列のキャッシュ用
         volatile Note* p_note;
@@ -1051,20 +2489,22 @@ public:
         volatile uint32_t* p_osc2_phase_delta;
         volatile int32_t (*p_osc1_spread_pan)[2];
         volatile int32_t (*p_osc2_spread_pan)[2];
-        int16_t* p_buffer_L;
-        int16_t* p_buffer_R;
+        uint32_t* p_frame;
+
+        bool os_active_local = os_active;
+        bool fm_local = fm_modulation;
+        int32_t fm_index_local = fm_index;
 
         // 変数のキャッシュ
         uint8_t osc1_v = osc1_voice;
+        bool skip_sub = gov_skip_sub;
         uint8_t osc2_v = osc2_voice;
         uint16_t osc1_level_local = osc1_level;
         uint16_t osc2_level_local = osc2_level;
         uint16_t osc_sub_level_local = osc_sub_level;
-        uint8_t pan_local = pan;
-
-        // バッファ初期化
-        memset(buffer_L, 0, size * sizeof(int16_t));
-        memset(buffer_R, 0, size * sizeof(int16_t));
+        int32_t pan_gain_L_local = pan_gain_L;
+        bool noise_local = noise_type != NOISE_OFF;
+        int16_t noise_pre_level = 0;
 
         // レベル調整用 OSCが複数ある場合下げる
         uint16_t osc_divide = 100;
@@ -1072,7 +2512,11 @@ public:
         if(osc1_wave != nullptr) not_null++;
         if(osc2_wave != nullptr) not_null++;
         if(osc_sub_wave != nullptr) not_null++;
-        if(not_null == 3) {
+        if(noise_local) not_null++;
+        if(not_null == 4) {
+            osc_divide = DIVIDE_FIXED[3];
+        }
+        else if(not_null == 3) {
             osc_divide = DIVIDE_FIXED[2];
         }
         else if(not_null == 2) {
@@ -1081,20 +2525,48 @@ public:
 
         // core1用
         calc_divide = osc_divide;
+        noise_pre_level = (noise_level * 100) / osc_divide;
 
         // バッファ配列の事前キャッシュ
-        p_buffer_L = &buffer_L[0];
-        p_buffer_R = &buffer_R[0];
+        p_frame = &frames[offset];
+
+        for (size_t i = offset; i < offset + size; ++i, ++p_frame) {
+            render_index = i;
+
+            // コントロールレート処理 (core1は待機中)
+            if ((i & (CONTROL_RATE - 1)) == 0) {
+                updateControl();
+                osc1_level_local = osc1_level;
+                osc2_level_local = osc2_level;
+                osc_sub_level_local = osc_sub_level;
+                pan_gain_L_local = pan_gain_L;
+                fm_index_local = fm_index;
+
+                // 音程の変更を発音中のノートへ反映
+                if(retune_flags) applyRetune();
+
+                // ノイズの生成
+                if(noise_local) {
+                    fillNoise(os_active_local);
+                    noise_pre_level = (noise_level * 100) / osc_divide;
+                }
+            }
+
+            // ノイズ (全ノート共通)
+            if(noise_local) {
+                uint8_t k = (i & (CONTROL_RATE - 1)) << os_active_local;
+                NOISE = (noise_buf[k] * noise_pre_level) >> 10;
+                if(os_active_local) NOISE_MID = (noise_buf[k + 1] * noise_pre_level) >> 10;
+            }
 
-        for (size_t i = 0; i < size; ++i, ++p_buffer_L, ++p_buffer_R) {
             // notesの1アドレス
             p_note = &notes[1];
 
             // core1で半分計算
-            /*core1*/ calc_mode = CALC_NOTE;
+            /*core1*/ START_CORE1(CALC_NOTE);
 
             // 1, 3, 5...
-            for (uint8_t n = 1; n < MAX_NOTES; n += 2, p_note += 2) {
+            for (uint8_t n = 1; n < NOTE_SLOTS; n += 2, p_note += 2) {
                 if (!p_note->active) continue;
 
                 // 初期化
@@ -1107,8 +2579,10 @@ public:
                 p_osc2_phase = &p_note->osc2_phase[0];
                 p_osc1_spread_pan = &osc1_spread_pan[0];
                 p_osc2_spread_pan = &osc2_spread_pan[0];
+                osc1_mask = p_note->osc1_mask;
+                osc2_mask = p_note->osc2_mask;
 
-                if (osc1_wave != nullptr || osc2_wave != nullptr || osc_sub_wave != nullptr) {
+                if (osc1_wave != nullptr || osc2_wave != nullptr || osc_sub_wave != nullptr || noise_local) {
 
                     /**
                      * Amplifier + Envelope Generator
@@ -1146,22 +2620,40 @@ public:
                         p_note->adsr_gain = adsr_gain;
                     }
 
+                    /**
+                     * FM (OSC2 -> OSC1 の位相変調)
+                     * 専用処理でOSC1を生成し、OSC2は変調にのみ使います
+                     */
+                    if(fm_local) {
+                        renderFM(p_note, osc1_v, fm_index_local, false, &OSC1_L, &OSC1_R);
+                        osc1_pre_level = (osc1_level_local*100) / osc_divide;
+                        OSC1_L = (OSC1_L * (osc1_pre_level)) >> 10;
+                        OSC1_R = (OSC1_R * (osc1_pre_level)) >> 10;
+                    }
+
                     /**
                      * Oscillator 1
                      * オシレーターで波形を生成します
                      */
-                    if(osc1_wave != nullptr) {
+                    if(osc1_wave != nullptr && !fm_local) {
                         if(osc1_v == 1) {
                             OSC1 = osc1_wave[(*p_osc1_phase >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
-                            OSC1_L += OSC1;
-                            OSC1_R += OSC1;
+                            if(osc1_panned) {
+                                OSC1_L += (OSC1 * osc1_spread_pan[0][0]) >> FIXED_SHIFT;
+                                OSC1_R += (OSC1 * osc1_spread_pan[0][1]) >> FIXED_SHIFT;
+                            }
+                            else {
+                                OSC1_L += OSC1;
+                                OSC1_R += OSC1;
+                            }
                         }
                         else {
-                            uint16_t divide = DIVIDE_FIXED[osc1_v - 2];
+                            uint16_t divide = p_note->osc1_divide;
                             for(d = 0; d < osc1_v; ++d, ++p_osc1_phase, ++p_osc1_spread_pan) {
+                                if(!(osc1_mask & (1 << d))) continue; // 間引いたボイス
                                 OSC1 = ((osc1_wave[(*p_osc1_phase >> BIT_SHIFT) & (SAMPLE_SIZE - 1)])*100) / divide;
-                                OSC1_L += (OSC1 * (*p_osc1_spread_pan[0])) >> FIXED_SHIFT; // cos
-                                OSC1_R += (OSC1 * (*p_osc1_spread_pan[1])) >> FIXED_SHIFT; // sin
+                                OSC1_L += (OSC1 * (*p_osc1_spread_pan)[0]) >> FIXED_SHIFT; // cos
+                                OSC1_R += (OSC1 * (*p_osc1_spread_pan)[1]) >> FIXED_SHIFT; // sin
                             }
                         }
                         // OSC1レベル処理
@@ -1174,18 +2666,25 @@ public:
                      * Oscillator 2
                      * オシレーターで波形を生成します
                      */
-                    if(osc2_wave != nullptr) {
+                    if(osc2_wave != nullptr && !fm_local) {
                         if(osc2_v == 1) {
                             OSC2 = osc2_wave[(*p_osc2_phase >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
-                            OSC2_L += OSC2;
-                            OSC2_R += OSC2;
+                            if(osc2_panned) {
+                                OSC2_L += (OSC2 * osc2_spread_pan[0][0]) >> FIXED_SHIFT;
+                                OSC2_R += (OSC2 * osc2_spread_pan[0][1]) >> FIXED_SHIFT;
+                            }
+                            else {
+                                OSC2_L += OSC2;
+                                OSC2_R += OSC2;
+                            }
                         }
                         else {
-                            uint16_t divide = DIVIDE_FIXED[osc2_v - 2];
+                            uint16_t divide = p_note->osc2_divide;
                             for(d = 0; d < osc2_v; ++d, ++p_osc2_phase, ++p_osc2_spread_pan) {
+                                if(!(osc2_mask & (1 << d))) continue; // 間引いたボイス
                                 OSC2 = ((osc2_wave[(*p_osc2_phase >> BIT_SHIFT) & (SAMPLE_SIZE - 1)])*100) / divide;
-                                OSC2_L += (OSC2 * (*p_osc2_spread_pan[0])) >> FIXED_SHIFT; // cos
-                                OSC2_R += (OSC2 * (*p_osc2_spread_pan[1])) >> FIXED_SHIFT; // sin
+                                OSC2_L += (OSC2 * (*p_osc2_spread_pan)[0]) >> FIXED_SHIFT; // cos
+                                OSC2_R += (OSC2 * (*p_osc2_spread_pan)[1]) >> FIXED_SHIFT; // sin
                             }
                         }
                         // OSC2レベル処理
@@ -1198,10 +2697,16 @@ public:
                      * Oscillator SUB
                      * オシレーターで波形を生成します
                      */
-                    if(osc_sub_wave != nullptr) {
+                    if(osc_sub_wave != nullptr && !skip_sub) {
                         OSC_SUB = osc_sub_wave[(p_note->osc_sub_phase >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
-                        OSC_SUB_L += OSC_SUB;
-                        OSC_SUB_R += OSC_SUB;
+                        if(osc_sub_panned) {
+                            OSC_SUB_L += (OSC_SUB * osc_sub_pan_gain[0][0]) >> FIXED_SHIFT;
+                            OSC_SUB_R += (OSC_SUB * osc_sub_pan_gain[0][1]) >> FIXED_SHIFT;
+                        }
+                        else {
+                            OSC_SUB_L += OSC_SUB;
+                            OSC_SUB_R += OSC_SUB;
+                        }
                         // OSC_SUBレベル処理
                         osc_sub_pre_level = ((osc_sub_level_local*100) / osc_divide);
                         OSC_SUB_L = (OSC_SUB_L * (osc_sub_pre_level)) >> 10;
@@ -1225,13 +2730,20 @@ public:
                     }
 
                     // OSC合成
-                    L = OSC1_L + OSC2_L + OSC_SUB_L;
-                    R = OSC1_R + OSC2_R + OSC_SUB_R;
+                    L = OSC1_L + OSC2_L + OSC_SUB_L + NOISE;
+                    R = OSC1_R + OSC2_R + OSC_SUB_R + NOISE;
 
                     // アンプボリューム処理
                     calc_result_L += (((L * p_note->adsr_gain) >> 10) * p_note->gain) >> 10;
                     calc_result_R += (((R * p_note->adsr_gain) >> 10) * p_note->gain) >> 10;
 
+                    // 2倍オーバーサンプリング時は位相を半分進めた中間サンプルも生成
+                    if(os_active_local) {
+                        renderMidSample(p_note, osc1_v, osc2_v, osc1_pre_level, osc2_pre_level, osc_sub_pre_level, skip_sub, fm_local, fm_index_local, NOISE_MID, &L, &R);
+                        calc_result_L2 += L;
+                        calc_result_R2 += R;
+                    }
+
                     p_osc1_phase = &p_note->osc1_phase[0];
                     p_osc2_phase = &p_note->osc2_phase[0];
                     p_osc1_phase_delta = &p_note->osc1_phase_delta[0];
@@ -1266,12 +2778,18 @@ public:
             // core1を待つ
             while(calc_mode == CALC_NOTE);
 
-            *p_buffer_L += calc_result_L;
-            *p_buffer_R += calc_result_R;
+            if(os_active_local) {
+                out_L = decimator_L.process(calc_result_L, calc_result_L2);
+                out_R = decimator_R.process(calc_result_R, calc_result_R2);
+            }
+            else {
+                out_L = calc_result_L;
+                out_R = calc_result_R;
+            }
 
             // core1で次Rのパン計算
-            /*core1*/ calc_r = *p_buffer_R;
-            /*core1*/ calc_mode = CALC_PAN_FILTER;
+            /*core1*/ calc_r = out_R;
+            /*core1*/ START_CORE1(CALC_PAN_FILTER);
 
             // core1では処理できないのでこちらで処理
             p_note = &notes[0];
@@ -1305,36 +2823,98 @@ public:
                 }
             }
 
+            // フェード用スロットの強制リリースが終了
+            for (uint8_t n = MAX_NOTES; n < NOTE_SLOTS; ++n, ++p_note) {
+                if (p_note->active && p_note->force_release_cnt == 0) {
+                    p_note->active = false;
+                    p_note->note = 0xff;
+                }
+            }
+
             // パン処理
-            *p_buffer_L = (*p_buffer_L * PAN_COS_TABLE[pan_local]) / INT16_MAX;
+            out_L = (out_L * pan_gain_L_local) / INT16_MAX;
 
             // フィルタ処理
             if(lpf_enabled) {
-                *p_buffer_L = lpfProcessL(*p_buffer_L);
+                out_L = lpfProcessL(out_L);
             }
             if(hpf_enabled) {
-                *p_buffer_L = hpfProcessL(*p_buffer_L);
+                out_L = hpfProcessL(out_L);
             }
 
             // core1を待つ
             while(calc_mode == CALC_PAN_FILTER);
 
-            *p_buffer_R = calc_r;
+            out_R = calc_r;
 
             // ディレイ処理
             if(delay_enabled) {
-                *p_buffer_L = delayProcess(*p_buffer_L, 0x00);
-                *p_buffer_R = delayProcess(*p_buffer_R, 0x01);
+                out_L = delayProcess(out_L, 0x00);
+                out_R = delayProcess(out_R, 0x01);
+            }
+
+            *p_frame = FRAME_PACK(out_L, out_R);
+        }
+
+        // 区切りの間のノートオンは次のサンプルから
+        render_index = offset + size - 1;
+    }
+
+    /**
+     * @brief ブロックの生成を終了します
+     * @param size ブロックのフレーム数
+     */
+    void endBlock(size_t size) {
+        volatile Note* p_note;
+        render_index = -1;
+
+        // 発音開始位置の記録
+        started_count = 0;
+        p_note = &notes[0];
+        for (uint8_t n = 0; n < MAX_NOTES; ++n, ++p_note) {
+            if (!p_note->started) continue;
+            if (p_note->start_index >= (int16_t)size) {
+                p_note->start_index -= size;
+                continue;
             }
+            p_note->started = false;
+            if (!p_note->active) continue;
+            started_note[started_count] = p_note->note;
+            started_index[started_count] = p_note->start_index;
+            started_count++;
+        }
+    }
+
+    /**
+     * @brief 直前のブロックで最初の発音サンプルを生成したノートを取得します
+     * @param note ノート番号の出力先
+     * @param index ブロック内のサンプル位置の出力先
+     * @param size 出力先の要素数
+     * @return ノート数
+     */
+    uint8_t getStartedNotes(uint8_t* note, uint16_t* index, uint8_t size) {
+        uint8_t n = 0;
+        for (; n < started_count && n < size; ++n) {
+            note[n] = started_note[n];
+            index[n] = started_index[n];
         }
+        return n;
+    }
+
+    /**
+     * @brief core1の処理待ちか (負荷計測用)
+     */
+    bool isCore1Pending() {
+        return calc_mode != CALC_IDLE;
     }
 
     /**
      * @brief CORE1で負荷分散処理
      * 非CALC_IDLE時の変数アクセスに注意
+     * @return 処理を行った場合 true (負荷計測用)
      */
-    void generate1() {
-        if(calc_mode == CALC_IDLE) return;
+    bool generate1() {
+        if(calc_mode == CALC_IDLE) return false;
 
         else if(calc_mode == CALC_NOTE) {
 
@@ -1346,8 +2926,9 @@ public:
             int16_t OSC_SUB_L, OSC_SUB_R;
             int16_t L, RM_L;
             int16_t R, RM_R;
-            int16_t osc1_pre_level, osc2_pre_level, osc_sub_pre_level;
+            int16_t osc1_pre_level = 0, osc2_pre_level = 0, osc_sub_pre_level = 0;
             int32_t adsr_gain;
+            uint8_t osc1_mask, osc2_mask;
 
             // 配列のキャッシュ用
             volatile Note* p_note;
@@ -1362,20 +2943,36 @@ public:
 
             // 変数のキャッシュ
             uint8_t osc1_v = osc1_voice;
+            bool skip_sub = gov_skip_sub;
             uint8_t osc2_v = osc2_voice;
             uint16_t osc1_level_local = osc1_level;
             uint16_t osc2_level_local = osc2_level;
             uint16_t osc_sub_level_local = osc_sub_level;
             uint16_t osc_divide = calc_divide;
+            bool noise_local = noise_type != NOISE_OFF;
+            int16_t NOISE = 0, NOISE_MID = 0;
+
+            // ノイズ (core0がコントロールレート毎に生成)
+            if(noise_local) {
+                int16_t noise_pre_level = (noise_level * 100) / osc_divide;
+                uint8_t k = (render_index & (CONTROL_RATE - 1)) << os_active;
+                NOISE = (noise_buf[k] * noise_pre_level) >> 10;
+                if(os_active) NOISE_MID = (noise_buf[k + 1] * noise_pre_level) >> 10;
+            }
+            bool os_active_local = os_active;
+            bool fm_local = fm_modulation;
+            int32_t fm_index_local = fm_index;
 
             // notesの先頭アドレス
             p_note = &notes[0];
 
             calc_result_L = 0;
             calc_result_R = 0;
+            calc_result_L2 = 0;
+            calc_result_R2 = 0;
 
             // 0, 2, 4...
-            for (uint8_t n = 0; n < MAX_NOTES; n += 2, p_note += 2) {
+            for (uint8_t n = 0; n < NOTE_SLOTS; n += 2, p_note += 2) {
                 if (!p_note->active) continue;
 
                 // 初期化
@@ -1388,8 +2985,10 @@ public:
                 p_osc2_phase = &p_note->osc2_phase[0];
                 p_osc1_spread_pan = &osc1_spread_pan[0];
                 p_osc2_spread_pan = &osc2_spread_pan[0];
+                osc1_mask = p_note->osc1_mask;
+                osc2_mask = p_note->osc2_mask;
 
-                if (osc1_wave != nullptr || osc2_wave != nullptr || osc_sub_wave != nullptr) {
+                if (osc1_wave != nullptr || osc2_wave != nullptr || osc_sub_wave != nullptr || noise_local) {
 
                     /**
                      * Amplifier + Envelope Generator
@@ -1427,22 +3026,40 @@ public:
                         p_note->adsr_gain = adsr_gain;
                     }
 
+                    /**
+                     * FM (OSC2 -> OSC1 の位相変調)
+                     * 専用処理でOSC1を生成し、OSC2は変調にのみ使います
+                     */
+                    if(fm_local) {
+                        renderFM(p_note, osc1_v, fm_index_local, false, &OSC1_L, &OSC1_R);
+                        osc1_pre_level = (osc1_level_local*100) / osc_divide;
+                        OSC1_L = (OSC1_L * (osc1_pre_level)) >> 10;
+                        OSC1_R = (OSC1_R * (osc1_pre_level)) >> 10;
+                    }
+
                     /**
                      * Oscillator 1
                      * オシレーターで波形を生成します
                      */
-                    if(osc1_wave != nullptr) {
+                    if(osc1_wave != nullptr && !fm_local) {
                         if(osc1_v == 1) {
                             OSC1 = osc1_wave[(*p_osc1_phase >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
-                            OSC1_L += OSC1;
-                            OSC1_R += OSC1;
+                            if(osc1_panned) {
+                                OSC1_L += (OSC1 * osc1_spread_pan[0][0]) >> FIXED_SHIFT;
+                                OSC1_R += (OSC1 * osc1_spread_pan[0][1]) >> FIXED_SHIFT;
+                            }
+                            else {
+                                OSC1_L += OSC1;
+                                OSC1_R += OSC1;
+                            }
                         }
                         else {
-                            uint16_t divide = DIVIDE_FIXED[osc1_v - 2];
+                            uint16_t divide = p_note->osc1_divide;
                             for(d = 0; d < osc1_v; ++d, ++p_osc1_phase, ++p_osc1_spread_pan) {
+                                if(!(osc1_mask & (1 << d))) continue; // 間引いたボイス
                                 OSC1 = ((osc1_wave[(*p_osc1_phase >> BIT_SHIFT) & (SAMPLE_SIZE - 1)])*100) / divide;
-                                OSC1_L += (OSC1 * (*p_osc1_spread_pan[0])) >> FIXED_SHIFT; // cos
-                                OSC1_R += (OSC1 * (*p_osc1_spread_pan[1])) >> FIXED_SHIFT; // sin
+                                OSC1_L += (OSC1 * (*p_osc1_spread_pan)[0]) >> FIXED_SHIFT; // cos
+                                OSC1_R += (OSC1 * (*p_osc1_spread_pan)[1]) >> FIXED_SHIFT; // sin
                             }
                         }
                         // OSC1レベル処理
@@ -1455,18 +3072,25 @@ public:
                      * Oscillator 2
                      * オシレーターで波形を生成します
                      */
-                    if(osc2_wave != nullptr) {
+                    if(osc2_wave != nullptr && !fm_local) {
                         if(osc2_v == 1) {
                             OSC2 = osc2_wave[(*p_osc2_phase >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
-                            OSC2_L += OSC2;
-                            OSC2_R += OSC2;
+                            if(osc2_panned) {
+                                OSC2_L += (OSC2 * osc2_spread_pan[0][0]) >> FIXED_SHIFT;
+                                OSC2_R += (OSC2 * osc2_spread_pan[0][1]) >> FIXED_SHIFT;
+                            }
+                            else {
+                                OSC2_L += OSC2;
+                                OSC2_R += OSC2;
+                            }
                         }
                         else {
-                            uint16_t divide = DIVIDE_FIXED[osc2_v - 2];
+                            uint16_t divide = p_note->osc2_divide;
                             for(d = 0; d < osc2_v; ++d, ++p_osc2_phase, ++p_osc2_spread_pan) {
+                                if(!(osc2_mask & (1 << d))) continue; // 間引いたボイス
                                 OSC2 = ((osc2_wave[(*p_osc2_phase >> BIT_SHIFT) & (SAMPLE_SIZE - 1)])*100) / divide;
-                                OSC2_L += (OSC2 * (*p_osc2_spread_pan[0])) >> FIXED_SHIFT; // cos
-                                OSC2_R += (OSC2 * (*p_osc2_spread_pan[1])) >> FIXED_SHIFT; // sin
+                                OSC2_L += (OSC2 * (*p_osc2_spread_pan)[0]) >> FIXED_SHIFT; // cos
+                                OSC2_R += (OSC2 * (*p_osc2_spread_pan)[1]) >> FIXED_SHIFT; // sin
                             }
                         }
                         // OSC2レベル処理
@@ -1479,10 +3103,16 @@ public:
                      * Oscillator SUB
                      * オシレーターで波形を生成します
                      */
-                    if(osc_sub_wave != nullptr) {
+                    if(osc_sub_wave != nullptr && !skip_sub) {
                         OSC_SUB = osc_sub_wave[(p_note->osc_sub_phase >> BIT_SHIFT) & (SAMPLE_SIZE - 1)];
-                        OSC_SUB_L += OSC_SUB;
-                        OSC_SUB_R += OSC_SUB;
+                        if(osc_sub_panned) {
+                            OSC_SUB_L += (OSC_SUB * osc_sub_pan_gain[0][0]) >> FIXED_SHIFT;
+                            OSC_SUB_R += (OSC_SUB * osc_sub_pan_gain[0][1]) >> FIXED_SHIFT;
+                        }
+                        else {
+                            OSC_SUB_L += OSC_SUB;
+                            OSC_SUB_R += OSC_SUB;
+                        }
                         // OSC_SUBレベル処理
                         osc_sub_pre_level = ((osc_sub_level_local*100) / osc_divide);
                         OSC_SUB_L = (OSC_SUB_L * (osc_sub_pre_level)) >> 10;
@@ -1506,13 +3136,20 @@ public:
                     }
 
                     // OSC合成
-                    L = OSC1_L + OSC2_L + OSC_SUB_L;
-                    R = OSC1_R + OSC2_R + OSC_SUB_R;
+                    L = OSC1_L + OSC2_L + OSC_SUB_L + NOISE;
+                    R = OSC1_R + OSC2_R + OSC_SUB_R + NOISE;
 
                     // アンプボリューム処理
                     calc_result_L += (((L * p_note->adsr_gain) >> 10) * p_note->gain) >> 10;
                     calc_result_R += (((R * p_note->adsr_gain) >> 10) * p_note->gain) >> 10;
 
+                    // 2倍オーバーサンプリング時は位相を半分進めた中間サンプルも生成
+                    if(os_active_local) {
+                        renderMidSample(p_note, osc1_v, osc2_v, osc1_pre_level, osc2_pre_level, osc_sub_pre_level, skip_sub, fm_local, fm_index_local, NOISE_MID, &L, &R);
+                        calc_result_L2 += L;
+                        calc_result_R2 += R;
+                    }
+
                     p_osc1_phase = &p_note->osc1_phase[0];
                     p_osc2_phase = &p_note->osc2_phase[0];
                     p_osc1_phase_delta = &p_note->osc1_phase_delta[0];
@@ -1524,28 +3161,28 @@ public:
                     if(glide_mode && isGlided && monophonic) {
                         // OSC1 次の位相へ
                         if(osc1_v == 1) {
-                            *p_osc1_glide_delta = lerp(*p_osc1_glide_delta, *p_osc1_phase_delta, 1.0f / (glide_time * SAMPLE_RATE / 1000.0f));
+                            *p_osc1_glide_delta = lerp(*p_osc1_glide_delta, *p_osc1_phase_delta, 1.0f / (glide_time * sample_rate / 1000.0f));
                             *p_osc1_phase += *p_osc1_glide_delta;
                         }
                         else {
                             for(d = 0; d < osc1_v; ++d, ++p_osc1_phase, ++p_osc1_phase_delta, ++p_osc1_glide_delta) {
-                                *p_osc1_glide_delta = lerp(*p_osc1_glide_delta, *p_osc1_phase_delta, 1.0f / (glide_time * SAMPLE_RATE / 1000.0f));
+                                *p_osc1_glide_delta = lerp(*p_osc1_glide_delta, *p_osc1_phase_delta, 1.0f / (glide_time * sample_rate / 1000.0f));
                                 *p_osc1_phase += *p_osc1_glide_delta;
                             }
                         }
                         // OSC2 次の位相へ
                         if(osc2_v == 1) {
-                            *p_osc2_glide_delta = lerp(*p_osc2_glide_delta, *p_osc2_phase_delta, 1.0f / (glide_time * SAMPLE_RATE / 1000.0f));
+                            *p_osc2_glide_delta = lerp(*p_osc2_glide_delta, *p_osc2_phase_delta, 1.0f / (glide_time * sample_rate / 1000.0f));
                             *p_osc2_phase += *p_osc2_glide_delta;
                         }
                         else {
-                            for(d = 0; d < osc2_v; ++d, ++p_osc2_phase, ++p_osc2_phase_delta) {
-                                *p_osc2_glide_delta = lerp(*p_osc2_glide_delta, *p_osc2_phase_delta, 1.0f / (glide_time * SAMPLE_RATE / 1000.0f));
+                            for(d = 0; d < osc2_v; ++d, ++p_osc2_phase, ++p_osc2_phase_delta, ++p_osc2_glide_delta) {
+                                *p_osc2_glide_delta = lerp(*p_osc2_glide_delta, *p_osc2_phase_delta, 1.0f / (glide_time * sample_rate / 1000.0f));
                                 *p_osc2_phase += *p_osc2_glide_delta;
                             }
                         }
                         // OSC SUB 次の位相へ
-                        p_note->osc_sub_glide_delta = lerp(p_note->osc_sub_glide_delta, p_note->osc_sub_phase_delta, 1.0f / (glide_time * SAMPLE_RATE / 1000.0f));
+                        p_note->osc_sub_glide_delta = lerp(p_note->osc_sub_glide_delta, p_note->osc_sub_phase_delta, 1.0f / (glide_time * sample_rate / 1000.0f));
                         p_note->osc_sub_phase += p_note->osc_sub_glide_delta;
                     }
 
@@ -1609,17 +3246,10 @@ public:
             calc_mode = CALC_IDLE;
         }
 
-        else if(calc_mode == CALC_SET_F) {
-            setFrequency(calc_i);
-            calc_mode = CALC_IDLE;
-        }
-
         else if(calc_mode == CALC_PAN_FILTER) {
 
-            uint8_t calc_pan = pan;
-
             // パン処理
-            calc_r = (calc_r * PAN_SIN_TABLE[calc_pan]) / INT16_MAX;
+            calc_r = (calc_r * pan_gain_R) / INT16_MAX;
 
             // フィルタ処理
             if(lpf_enabled) {
@@ -1631,5 +3261,8 @@ public:
 
             calc_mode = CALC_IDLE;
         }
+        return true;
     }
-};
\ No newline at end of file
+};
+
+#endif // SYNTH_H
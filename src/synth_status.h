@@ -0,0 +1,151 @@
+#ifndef SYNTHSTATUS_H
+#define SYNTHSTATUS_H
+
+#include <synth.h>
+
+#define STATUS_MAX_VOICES  16 // 記録するノート数 (パート数 x WaveGenerator::getMaxNotes())
+#define STATUS_HEADER_SIZE 9
+#define STATUS_VOICE_SIZE  4
+#define STATUS_DATA_SIZE   (STATUS_HEADER_SIZE + STATUS_MAX_VOICES * STATUS_VOICE_SIZE)
+
+#define STATUS_STEAL 0x80 // 入れ替え候補のフラグ
+
+/// 空きボイス・各ノートの状態・負荷・入れ替え候補 (SYNTH_GET_STATUS)
+///
+/// 2台構成 (SYNTH_ID 1/2) の CTRL が1回の読み出しで発音先のボードを選べるようにする。
+/// 本体はパート毎に addPart() で集計し serialize() で応答を作り、
+/// CTRL (およびホスト用シミュレータ) は parse() で読み戻す。
+class SynthStatus {
+public:
+    struct Voice {
+        uint8_t part;
+        uint8_t stage; // ENV_*
+        bool steal;    // 次のノートオンで入れ替えるノート
+        uint8_t note;
+        uint8_t level; // エンベロープの音量 0~255
+        uint8_t age;   // パート内の発音順 (0が最も古い)
+    };
+
+    uint8_t pool = 0;     // 全パートで共有する発音数
+    uint8_t free = 0;     // 空きボイス数 (強制リリース中は空きとみなす)
+    uint8_t governor = 0; // 負荷制御レベル
+    uint16_t load0 = 0;   // 直前のブロックの負荷 (千分率)
+    uint16_t load1 = 0;
+    uint8_t voice_count = 0;
+    uint8_t dropped = 0;  // 予約の空きが無く直ちに適用した命令の数 (255で飽和)
+    Voice voices[STATUS_MAX_VOICES];
+
+    /**
+     * @brief 集計を開始します
+     * @param voice_pool 全パートで共有する発音数
+     * @param core0 core0の負荷 (千分率)
+     * @param core1 core1の負荷 (千分率)
+     * @param level 負荷制御レベル
+     * @param overflow EventQueue::getDropped()
+     */
+    void begin(uint8_t voice_pool, uint16_t core0, uint16_t core1, uint8_t level, uint32_t overflow) {
+        pool = voice_pool;
+        free = voice_pool;
+        governor = level;
+        load0 = core0;
+        load1 = core1;
+        voice_count = 0;
+        dropped = overflow > 255 ? 255 : overflow;
+    }
+
+    /**
+     * @brief パートの発音中のノートを追加します
+     */
+    void addPart(WaveGenerator& wave, uint8_t part) {
+        int8_t steal = wave.getStealCandidate();
+
+        for(uint8_t i = 0; i < WaveGenerator::getMaxNotes(); ++i) {
+            uint8_t note;
+            uint16_t level;
+            uint8_t age;
+            uint8_t stage = wave.getNoteState(i, &note, &level, &age);
+            if(stage == ENV_IDLE) continue;
+
+            if(stage != ENV_FORCE_RELEASE && free > 0) free--;
+            if(voice_count >= STATUS_MAX_VOICES) continue;
+
+            Voice& v = voices[voice_count++];
+            v.part = part;
+            v.stage = stage;
+            v.steal = (i == steal);
+            v.note = note;
+            v.level = level >= 1020 ? 255 : level >> 2;
+            v.age = age;
+        }
+    }
+
+    /**
+     * @brief 状態をバイト列にします (リトルエンディアン)
+     * {pool, free, governor, load0(u16), load1(u16), voice_count, dropped,
+     *  voices[voice_count] x {steal<<7 | part<<4 | stage, note, level, age}}
+     * @return 書き込んだバイト数
+     */
+    uint8_t serialize(uint8_t* out) {
+        uint8_t n = 0;
+        out[n++] = pool;
+        out[n++] = free;
+        out[n++] = governor;
+        out[n++] = load0 & 0xFF;
+        out[n++] = load0 >> 8;
+        out[n++] = load1 & 0xFF;
+        out[n++] = load1 >> 8;
+        out[n++] = voice_count;
+        out[n++] = dropped;
+        for(uint8_t i = 0; i < voice_count; ++i) {
+            const Voice& v = voices[i];
+            out[n++] = (v.steal ? STATUS_STEAL : 0x00) | ((v.part & 0x07) << 4) | (v.stage & 0x0F);
+            out[n++] = v.note;
+            out[n++] = v.level;
+            out[n++] = v.age;
+        }
+        return n;
+    }
+
+    /**
+     * @brief serialize() のバイト列を読み込みます (CTRL側)
+     * @return サイズが足りない場合 false
+     */
+    bool parse(const uint8_t* in, uint8_t size) {
+        if(size < STATUS_HEADER_SIZE) return false;
+        uint8_t count = in[7];
+        if(count > STATUS_MAX_VOICES || size < STATUS_HEADER_SIZE + count * STATUS_VOICE_SIZE) return false;
+
+        pool = in[0];
+        free = in[1];
+        governor = in[2];
+        load0 = in[3] | (in[4] << 8);
+        load1 = in[5] | (in[6] << 8);
+        voice_count = count;
+        dropped = in[8];
+
+        const uint8_t* p = &in[STATUS_HEADER_SIZE];
+        for(uint8_t i = 0; i < count; ++i, p += STATUS_VOICE_SIZE) {
+            Voice& v = voices[i];
+            v.steal = p[0] & STATUS_STEAL;
+            v.part = (p[0] >> 4) & 0x07;
+            v.stage = p[0] & 0x0F;
+            v.note = p[1];
+            v.level = p[2];
+            v.age = p[3];
+        }
+        return true;
+    }
+
+    /**
+     * @brief パートの入れ替え候補を取得します
+     * @return 候補が無い場合 nullptr
+     */
+    const Voice* getSteal(uint8_t part = 0) {
+        for(uint8_t i = 0; i < voice_count; ++i) {
+            if(voices[i].steal && voices[i].part == part) return &voices[i];
+        }
+        return nullptr;
+    }
+};
+
+#endif // SYNTHSTATUS_H
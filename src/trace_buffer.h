@@ -0,0 +1,106 @@
+#ifndef TRACEBUFFER_H
+#define TRACEBUFFER_H
+
+#define TRACE_SLOTS     256  // 記録するフレーム数 (古いものから上書き)
+#define TRACE_BYTES     8192 // フレームの内容を保存する領域 (byte)
+#define TRACE_FRAME_MAX 256  // 1フレームに保存する最大バイト数 (main.cpp の BATCH_SIZE)
+
+/// 受信フレームの記録 (サンプルクロックのタイムスタンプ付き)
+///
+/// フレームの内容は可変長で共有の領域へ順に詰めて保存し、
+/// 枠数か領域のどちらかが足りなくなった時点で古いフレームから上書きする。
+class TraceBuffer {
+public:
+    struct Frame {
+        uint32_t sample; // 受信時のサンプルクロック (演奏命令は適用する位置)
+        uint16_t size;   // 元のフレームのバイト数
+        uint16_t offset; // 内容の保存位置
+    };
+
+private:
+    Frame frames[TRACE_SLOTS];
+    uint8_t data_buff[TRACE_BYTES];
+    uint16_t head = 0;      // 次に書き込む位置
+    uint16_t count = 0;     // 記録数
+    uint16_t data_head = 0; // 次に内容を書き込む位置
+    uint16_t data_used = 0; // 保存中の内容のバイト数
+    uint32_t overwritten = 0;
+    volatile bool paused = false;
+
+    static uint16_t storedSize(uint16_t size) {
+        return size < TRACE_FRAME_MAX ? size : TRACE_FRAME_MAX;
+    }
+
+public:
+    /**
+     * @brief 1フレームを記録します
+     * TRACE_FRAME_MAX を超える部分は保存しない
+     */
+    void record(uint32_t sample, const uint8_t* data, int size) {
+        if(paused || size < 1) return;
+        uint16_t stored = storedSize(size);
+
+        // 最も古いフレームから空ける
+        while(count > 0 && (count == TRACE_SLOTS || data_used + stored > TRACE_BYTES)) {
+            data_used -= storedSize(frames[(head + TRACE_SLOTS - count) % TRACE_SLOTS].size);
+            count--;
+            overwritten++;
+        }
+
+        Frame* f = &frames[head];
+        f->sample = sample;
+        f->size = size;
+        f->offset = data_head;
+
+        // 領域の末尾で折り返す
+        uint16_t first = TRACE_BYTES - data_head;
+        if(first > stored) first = stored;
+        memcpy(&data_buff[data_head], data, first);
+        memcpy(data_buff, &data[first], stored - first);
+        data_head = (data_head + stored) % TRACE_BYTES;
+        data_used += stored;
+
+        head = (head + 1) % TRACE_SLOTS;
+        count++;
+    }
+
+    // 読み出し中は記録を止める
+    void pause(bool pause) {
+        paused = pause;
+    }
+
+    void clear() {
+        head = 0;
+        count = 0;
+        data_head = 0;
+        data_used = 0;
+        overwritten = 0;
+    }
+
+    uint16_t getCount() {
+        return count;
+    }
+
+    uint32_t getOverwritten() {
+        return overwritten;
+    }
+
+    /**
+     * @brief 記録したフレームを取得します
+     * @param index 0が最も古いフレーム
+     */
+    const Frame* get(uint16_t index) {
+        if(index >= count) return nullptr;
+        return &frames[(head + TRACE_SLOTS - count + index) % TRACE_SLOTS];
+    }
+
+    /**
+     * @brief フレームの内容を1バイト取得します
+     * @param i 0 ~ min(size, TRACE_FRAME_MAX) - 1
+     */
+    uint8_t getData(const Frame* f, uint16_t i) {
+        return data_buff[(f->offset + i) % TRACE_BYTES];
+    }
+};
+
+#endif // TRACEBUFFER_H
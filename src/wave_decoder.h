@@ -0,0 +1,89 @@
+#ifndef WAVEDECODER_H
+#define WAVEDECODER_H
+
+#define WD_SAMPLE_SIZE 2048
+
+/// 圧縮ユーザー波形のデコーダ (SYNTH_SET_CZSHAPE)
+///
+/// 2次線形予測 (pred = 2 * x[n-1] - x[n-2]) の残差をトークン列で送る。
+/// トークンはフレームを跨いでもよい（1バイトずつ状態を保持してデコード）。
+///   0x00~0x3F : 残差0が (b + 1) 個続く
+///   0x40~0x7F : 残差 (b - 0x60)          -32 ~ 31
+///   0x80~0xFE : 残差 ((b & 0x7F) << 8 | 次のバイト) - 16384
+///   0xFF      : 生サンプル (次の2バイト, リトルエンディアン)
+/// 対応するエンコーダは tools/wave_converter.py
+class WaveDecoder {
+private:
+    int16_t* table = nullptr;
+    uint16_t index = 0;
+    int32_t x1 = 0, x2 = 0; // 直前2サンプル
+
+    uint8_t token = 0;   // 処理中のトークン
+    uint8_t pending = 0; // トークンの残りバイト数
+    uint8_t lo = 0;      // 生サンプルの下位バイト
+
+    void put(int32_t sample) {
+        table[index++] = static_cast<int16_t>(sample);
+        x2 = x1;
+        x1 = static_cast<int16_t>(sample);
+    }
+
+    void putResidual(int32_t residual) {
+        put(2 * x1 - x2 + residual);
+    }
+
+public:
+    void begin(int16_t* table) {
+        this->table = table;
+        index = 0;
+        x1 = x2 = 0;
+        token = 0;
+        pending = 0;
+    }
+
+    bool isComplete() {
+        return table != nullptr && index >= WD_SAMPLE_SIZE;
+    }
+
+    /**
+     * @brief 受信データをデコードします
+     * @return テーブルが埋まった場合 true
+     */
+    bool decode(const uint8_t* data, size_t size) {
+        if(table == nullptr) return false;
+
+        for(size_t i = 0; i < size && index < WD_SAMPLE_SIZE; ++i) {
+            uint8_t b = data[i];
+
+            // 複数バイトトークンの続き
+            if(pending > 0) {
+                pending--;
+                if(token == 0xFF) {
+                    if(pending == 1) lo = b;
+                    else put(static_cast<int16_t>((b << 8) | lo));
+                }
+                else {
+                    putResidual((((token & 0x7F) << 8) | b) - 16384);
+                }
+                continue;
+            }
+
+            if(b < 0x40) {
+                for(uint8_t n = 0; n <= b && index < WD_SAMPLE_SIZE; ++n) {
+                    putResidual(0);
+                }
+            }
+            else if(b < 0x80) {
+                putResidual(b - 0x60);
+            }
+            else {
+                token = b;
+                pending = (b == 0xFF) ? 2 : 1;
+            }
+        }
+
+        return isComplete();
+    }
+};
+
+#endif // WAVEDECODER_H
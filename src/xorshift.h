@@ -0,0 +1,30 @@
+#ifndef XORSHIFT_H
+#define XORSHIFT_H
+
+#define XORSHIFT_SEED 2463534242UL // 既定の種 (Marsaglia)
+
+/// 32bit xorshift 乱数 (周期 2^32-1)
+/// シフトとXORのみのため1回数サイクルで生成でき、種を固定すれば結果を再現できる
+class XorShift32 {
+private:
+    uint32_t state = XORSHIFT_SEED;
+
+public:
+    /**
+     * @brief 種を設定します (0は使えないため既定の種に置き換える)
+     */
+    void seed(uint32_t s) {
+        state = s != 0 ? s : XORSHIFT_SEED;
+    }
+
+    uint32_t next() {
+        uint32_t x = state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        state = x;
+        return x;
+    }
+};
+
+#endif // XORSHIFT_H
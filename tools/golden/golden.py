@@ -0,0 +1,138 @@
+"""
+DSP変更の回帰確認 (ゴールデン出力との比較)
+
+corpus/*.txt の命令スクリプトをオフラインレンダラで描画し、
+reference/*.wav と比較する。
+
+    python golden.py                 # ビット一致で比較
+    python golden.py --tolerance     # SNR・最大誤差で比較
+    python golden.py --update        # 基準を現在の出力で更新
+    python golden.py poly_saw delay  # 一部のケースのみ
+"""
+import argparse
+import math
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import wave
+from array import array
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+CORPUS_DIR = os.path.join(ROOT, "corpus")
+REFERENCE_DIR = os.path.join(ROOT, "reference")
+RENDERER_DIR = os.path.join(ROOT, "..", "renderer")
+RENDERER = os.path.join(RENDERER_DIR, "render")
+
+TAIL_SEC = "0.5"  # 最後の命令以降に描画する最大秒数 (ディレイの残響を打ち切る)
+
+
+def build_renderer():
+    """レンダラをビルドする"""
+    subprocess.run(["make", "-s", "-C", RENDERER_DIR], check=True)
+
+
+def render(script, out_path):
+    """命令スクリプトをWAVに描画し、generate()の処理時間(ms)を返す"""
+    result = subprocess.run([RENDERER, "-t", TAIL_SEC, "-o", out_path, script],
+                            check=True, stderr=subprocess.PIPE, text=True)
+    match = re.search(r"generate ([0-9.]+) ms", result.stderr)
+    return float(match.group(1)) if match else 0.0
+
+
+def read_pcm(path):
+    """16bitステレオWAVを読み込む"""
+    with wave.open(path, "rb") as wav_file:
+        if wav_file.getsampwidth() != 2:
+            raise ValueError(f"{path}: 16bit PCMのみ対応")
+        pcm = array("h")
+        pcm.frombytes(wav_file.readframes(wav_file.getnframes()))
+        if sys.byteorder == "big":
+            pcm.byteswap()
+        return wav_file.getframerate(), pcm
+
+
+def compare(ref, out):
+    """SNR(dB)と最大誤差を求める"""
+    n = min(len(ref), len(out))
+    signal = 0
+    noise = 0
+    peak = 0
+    for i in range(n):
+        diff = out[i] - ref[i]
+        signal += ref[i] * ref[i]
+        noise += diff * diff
+        if abs(diff) > peak:
+            peak = abs(diff)
+    if noise == 0:
+        snr = math.inf
+    elif signal == 0:
+        snr = -math.inf
+    else:
+        snr = 10 * math.log10(signal / noise)
+    return snr, peak
+
+
+def main():
+    parser = argparse.ArgumentParser(description="ゴールデン出力との比較")
+    parser.add_argument("cases", nargs="*", help="比較するケース名 (省略時は全て)")
+    parser.add_argument("--update", action="store_true", help="基準を現在の出力で更新")
+    parser.add_argument("--tolerance", action="store_true", help="ビット一致ではなく許容誤差で比較")
+    parser.add_argument("--snr", type=float, default=60.0, help="許容する最低SNR(dB)")
+    parser.add_argument("--peak", type=int, default=64, help="許容する最大誤差(LSB)")
+    args = parser.parse_args()
+
+    cases = args.cases or sorted(
+        os.path.splitext(f)[0] for f in os.listdir(CORPUS_DIR) if f.endswith(".txt"))
+
+    build_renderer()
+    os.makedirs(REFERENCE_DIR, exist_ok=True)
+    tmp_dir = tempfile.mkdtemp()
+    failed = 0
+
+    try:
+        for case in cases:
+            script = os.path.join(CORPUS_DIR, case + ".txt")
+            reference = os.path.join(REFERENCE_DIR, case + ".wav")
+            output = os.path.join(tmp_dir, case + ".wav")
+            generate_ms = render(script, output)
+
+            if args.update:
+                shutil.copyfile(output, reference)
+                print(f"{case:16s} updated")
+                continue
+
+            if not os.path.exists(reference):
+                print(f"{case:16s} FAIL  基準がありません (--update で作成)")
+                failed += 1
+                continue
+
+            ref_rate, ref = read_pcm(reference)
+            out_rate, out = read_pcm(output)
+            snr, peak = compare(ref, out)
+            length_ok = ref_rate == out_rate and len(ref) == len(out)
+
+            if args.tolerance:
+                ok = length_ok and snr >= args.snr and peak <= args.peak
+            else:
+                ok = length_ok and ref == out
+
+            status = "ok   " if ok else "FAIL "
+            detail = f"snr {snr:7.1f} dB  peak {peak:5d}  generate {generate_ms:7.2f} ms"
+            if not length_ok:
+                detail += f"  length {len(out) // 2}/{len(ref) // 2} frames"
+            print(f"{case:16s} {status} {detail}")
+            if not ok:
+                failed += 1
+    finally:
+        shutil.rmtree(tmp_dir)
+
+    if failed:
+        print(f"{failed}/{len(cases)} failed")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
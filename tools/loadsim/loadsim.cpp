@@ -0,0 +1,297 @@
+/**
+ * RP-DS16 2台構成の発音振り分けシミュレータ
+ *
+ * 実機と同じ WaveGenerator・CommandDecoder・SynthStatus を2台分用意し、
+ * CTRL が SYNTH_GET_STATUS の応答 (バイト列) だけを見て発音先を選ぶ流れを再現する。
+ * 比較用に SYNTH_GET_USED (1バイト) だけで選ぶ方式も同じ演奏で実行する。
+ *
+ * 使い方:
+ *   loadsim [-s seed] [-d sec] [-v unison] [-x scale]
+ *
+ *   -s  演奏を生成する乱数の種
+ *   -d  演奏の長さ (秒)
+ *   -v  OSC1のユニゾン数 (負荷の重さ)
+ *   -x  ホストでの処理時間を実機相当に換算する倍率
+ *       (0: ボイス数からの見積もり。実行毎に同じ結果になる。
+ *        0より大きい場合は実測のため実行毎に結果が変わる)
+ *
+ * 出力はボード毎の発音数・入れ替え (リリース中 / 発音中) の回数・負荷。
+ * 発音中のノートの入れ替えが少ないほど、音の途切れが少ない振り分けとなる。
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include <synth.h>
+#include <command_decoder.h>
+#include <load_meter.h>
+#include <governor.h>
+#include <synth_status.h>
+
+#define RATE       48000
+#define BLOCK      256 // main.cpp の BUFFER_SIZE
+#define BOARDS     2   // SYNTH_ID 1/2
+#define VOICE_POOL 4   // main.cpp の VOICE_POOL
+
+// 負荷の見積もり (-x 0): 1サンプルあたりの処理時間 (ns)
+#define MODEL_BASE_NS  1200 // ノートによらない処理 (ディレイ・フィルタ等)
+#define MODEL_VOICE_NS 700  // 1ボイスあたり
+
+struct Event {
+    uint64_t sample;
+    bool on;
+    uint8_t note;
+    uint8_t velocity;
+};
+
+/// 1台分のシンセ (main.cpp の該当処理を抜き出したもの)
+struct Board {
+    WaveGenerator wave{RATE};
+    CommandDecoder command{wave};
+    LoadMeter load0;
+    VoiceGovernor governor;
+    uint32_t frames[BLOCK];
+    uint8_t response = 0x00;
+
+    // 集計
+    uint32_t notes = 0;
+    uint32_t steal_release = 0; // リリース中のノートを入れ替えた回数
+    uint32_t steal_sounding = 0; // 発音中のノートを入れ替えた回数 (音が途切れる)
+    uint64_t load_sum = 0;
+    uint32_t load_blocks = 0;
+    uint16_t load_peak = 0;
+
+    void reset() {
+        uint8_t stop[1] = {SYNTH_SOUND_STOP};
+        command.process(stop, 1, &response);
+        load0.setDeadline((uint32_t)BLOCK * 1000000 / RATE);
+        load0.reset();
+        governor = VoiceGovernor();
+        wave.setGovernorLevel(GOV_NORMAL);
+        notes = steal_release = steal_sounding = 0;
+        load_sum = 0;
+        load_blocks = 0;
+        load_peak = 0;
+    }
+
+    void send(const uint8_t* data, int bytes) {
+        command.process(data, bytes, &response);
+    }
+
+    // SYNTH_GET_STATUS (main.cpp と同じ集計, 予約は使わない)
+    uint8_t getStatus(uint8_t* out) {
+        SynthStatus status;
+        status.begin(VOICE_POOL, load0.getLast(), 0, governor.getLevel(), 0);
+        status.addPart(wave, 0);
+        return status.serialize(out);
+    }
+
+    uint8_t getUsed() {
+        uint8_t data[1] = {SYNTH_GET_USED};
+        send(data, 1);
+        return response;
+    }
+
+    void render(double scale) {
+        uint32_t us;
+        if(scale > 0.0) {
+            auto start = std::chrono::steady_clock::now();
+            wave.generate(frames, BLOCK);
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            us = (uint32_t)(sec * 1e6 * scale);
+        }
+        else {
+            wave.generate(frames, BLOCK);
+            us = (uint32_t)((uint64_t)BLOCK * (MODEL_BASE_NS + MODEL_VOICE_NS * wave.getVoiceCount()) / 1000);
+        }
+
+        load0.add(us);
+        wave.setGovernorLevel(governor.update(load0.getLast(), BLOCK));
+        load_sum += load0.getLast();
+        load_blocks++;
+        if(load0.getLast() > load_peak) load_peak = load0.getLast();
+    }
+};
+
+static Board boards[BOARDS];
+
+/// CTRL側の振り分け方式
+enum Policy {
+    POLICY_USED,   // SYNTH_GET_USED が少ないボード
+    POLICY_STATUS, // SYNTH_GET_STATUS の空き・入れ替え候補・負荷
+};
+
+/**
+ * @brief ボードの選びやすさ (小さいほど良い)
+ * 空きがあれば負荷の低いボード、無ければリリース中で音量の小さいノートを入れ替えるボード
+ */
+static uint32_t statusCost(SynthStatus& s) {
+    uint16_t load = s.load0 > s.load1 ? s.load0 : s.load1;
+    if(s.free > 0) return (VOICE_POOL - s.free) * 1024 + load;
+
+    const SynthStatus::Voice* v = s.getSteal();
+    uint32_t cost = 0x100000;
+    if(v != nullptr) {
+        bool releasing = (v->stage == ENV_RELEASE || v->stage == ENV_FORCE_RELEASE);
+        cost += (releasing ? 0 : 0x10000) + v->level * 256;
+    }
+    return cost + load;
+}
+
+static uint8_t chooseBoard(Policy policy) {
+    if(policy == POLICY_USED) {
+        uint8_t best = 0;
+        uint8_t best_used = 0xff;
+        for(uint8_t b = 0; b < BOARDS; ++b) {
+            uint8_t used = boards[b].getUsed();
+            if(used < best_used) {
+                best_used = used;
+                best = b;
+            }
+        }
+        return best;
+    }
+
+    uint8_t best = 0;
+    uint32_t best_cost = UINT32_MAX;
+    for(uint8_t b = 0; b < BOARDS; ++b) {
+        // I2C越しの読み出しと同じくバイト列から復元する
+        uint8_t data[STATUS_DATA_SIZE];
+        uint8_t size = boards[b].getStatus(data);
+        SynthStatus s;
+        if(!s.parse(data, size)) continue;
+        uint32_t cost = statusCost(s);
+        if(cost < best_cost) {
+            best_cost = cost;
+            best = b;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief 和音と単音が混ざった演奏を生成します
+ */
+static std::vector<Event> makeSong(uint32_t seed, double sec) {
+    std::vector<Event> events;
+    srand(seed);
+    uint64_t end = (uint64_t)(sec * RATE);
+    uint64_t t = 0;
+
+    while(t < end) {
+        uint8_t chord = 1 + rand() % 4;
+        uint8_t root = 48 + rand() % 24;
+        for(uint8_t n = 0; n < chord; ++n) {
+            uint8_t note = root + n * (3 + rand() % 2);
+            uint64_t length = RATE * (100 + rand() % 1400) / 1000;
+            events.push_back({t, true, note, (uint8_t)(60 + rand() % 67)});
+            events.push_back({t + length, false, note, 0});
+        }
+        t += RATE * (60 + rand() % 400) / 1000;
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+        return a.sample < b.sample;
+    });
+    return events;
+}
+
+static void run(Policy policy, const std::vector<Event>& events, double scale) {
+    for(Board& b : boards) b.reset();
+
+    uint8_t owner[128]; // ノートを送ったボード (ノートオフの送り先)
+    memset(owner, 0xff, sizeof(owner));
+
+    uint64_t limit = events.empty() ? 0 : events.back().sample + RATE;
+    size_t next = 0;
+
+    for(uint64_t pos = 0; pos < limit; pos += BLOCK) {
+        while(next < events.size() && events[next].sample <= pos) {
+            const Event& e = events[next++];
+            if(e.on) {
+                uint8_t b = chooseBoard(policy);
+                Board& board = boards[b];
+
+                // 入れ替えの記録 (選び方によらず実際の状態で判定)
+                SynthStatus s;
+                uint8_t data[STATUS_DATA_SIZE];
+                s.parse(data, board.getStatus(data));
+                const SynthStatus::Voice* v = s.getSteal();
+                if(s.free == 0 && v != nullptr && !board.wave.isNote(e.note)) {
+                    if(v->stage == ENV_RELEASE || v->stage == ENV_FORCE_RELEASE) board.steal_release++;
+                    else board.steal_sounding++;
+                }
+
+                // 同じノートが別のボードで鳴っていれば先に止める
+                if(owner[e.note] != 0xff && owner[e.note] != b) {
+                    uint8_t off[3] = {SYNTH_NOTE_OFF, e.note, 0};
+                    boards[owner[e.note]].send(off, 3);
+                }
+                uint8_t on[3] = {SYNTH_NOTE_ON, e.note, e.velocity};
+                board.send(on, 3);
+                board.notes++;
+                owner[e.note] = b;
+            }
+            else if(owner[e.note] != 0xff) {
+                uint8_t off[3] = {SYNTH_NOTE_OFF, e.note, 0};
+                boards[owner[e.note]].send(off, 3);
+                owner[e.note] = 0xff;
+            }
+        }
+
+        for(Board& b : boards) {
+            if(b.wave.isGenerating()) b.render(scale);
+        }
+    }
+
+    uint32_t sounding = 0;
+    for(uint8_t i = 0; i < BOARDS; ++i) {
+        Board& b = boards[i];
+        sounding += b.steal_sounding;
+        printf("  board%u notes %5u  steal release %4u sounding %4u  load avg %4u peak %4u\n",
+            i + 1, b.notes, b.steal_release, b.steal_sounding,
+            b.load_blocks > 0 ? (unsigned)(b.load_sum / b.load_blocks) : 0, b.load_peak);
+    }
+    printf("  sounding steals %u\n", sounding);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: loadsim [-s seed] [-d sec] [-v unison] [-x scale]\n");
+}
+
+int main(int argc, char** argv) {
+    uint32_t seed = 1;
+    double sec = 30.0;
+    uint8_t unison = 4;
+    double scale = 0.0; // ボイス数からの見積もり
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc) sec = atof(argv[++i]);
+        else if(strcmp(argv[i], "-v") == 0 && i + 1 < argc) unison = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-x") == 0 && i + 1 < argc) scale = atof(argv[++i]);
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    for(Board& b : boards) {
+        b.wave.setVoice(unison, 1);
+        b.wave.setRelease(600);
+    }
+
+    std::vector<Event> events = makeSong(seed, sec);
+    printf("%zu events, seed %u, %.1f s, unison %u\n", events.size() / 2, seed, sec, unison);
+
+    printf("SYNTH_GET_USED\n");
+    run(POLICY_USED, events, scale);
+    printf("SYNTH_GET_STATUS\n");
+    run(POLICY_STATUS, events, scale);
+    return 0;
+}
@@ -0,0 +1,510 @@
+/**
+ * RP-DS16 オフラインレンダラ
+ *
+ * 実機と同じ WaveGenerator と CommandDecoder を使い、
+ * 命令スクリプトまたは Standard MIDI File を WAV に書き出す。
+ *
+ * 使い方:
+ *   render [-o out.wav] [-r sample_rate] [-b block_size] [-t tail_sec] [-s seed] [-q] <input.txt|input.mid>
+ *
+ * 命令スクリプト (1行1命令, # 以降はコメント):
+ *   <時刻ms> <命令> <データ...>
+ *   0    SYNTH_SET_SHAPE 0x02 0x01
+ *   0    SYNTH_NOTE_ON 60 100
+ *   500  SYNTH_NOTE_OFF 60 0
+ * 命令は instruction_set.h の名前または数値、データは10進数または0x付き16進数。
+ * 時刻を @<サンプル数> とするとサンプル単位で指定できる。
+ * 本体の SYNTH_DUMP_TRACE の出力 (I2C_TRACE) はこの形式のためそのまま再生できる。
+ * その先頭の記録開始時のパラメータは最初の命令より前に適用する (レンダラは1パートのためパート0のみ)。
+ *   !patch <part> <Patch のバイト列...>
+ *   !cshape <part> <osc> <ユーザー波形のバイト列 (int16 リトルエンディアン)...>
+ * SYNTH_SCHEDULE は遅延を時刻に加えて中の命令として扱う。
+ * 命令を MIDI とすると続くバイト列を UART MIDI と同じ MidiParser に通す
+ * (ランニングステータスは行をまたいで引き継ぐ)。
+ *   0    MIDI 0x90 60 100
+ *   100  MIDI 64 0xF8 100
+ *
+ * 実機と同様、発音中の演奏命令 (ノート・CC・ピッチベンド) はブロックを区切って
+ * 指定したサンプルから適用し、それ以外の命令はブロック境界で適用する。
+ * -q を付けると全ての命令をブロック境界で適用する。
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <synth.h>
+#include <command_decoder.h>
+#include <midi_parser.h>
+#include <event_queue.h>
+
+#define DEFAULT_RATE  48000
+#define DEFAULT_BLOCK 256 // main.cpp の BUFFER_SIZE
+#define MAX_BLOCK     1024
+#define DEFAULT_TAIL  10  // 最後の命令以降に鳴らし続ける最大秒数
+#define ARENA_SIZE    (128 * 1024) // main.cpp の ARENA_SIZE
+
+struct Event {
+    uint64_t sample;           // 適用するサンプル位置
+    std::vector<uint8_t> data; // 命令列
+};
+
+// 記録開始時のパラメータ (SYNTH_DUMP_TRACE の !patch / !cshape)
+struct Header {
+    bool has_patch = false;
+    Patch patch;
+    bool has_table[2] = {false, false};
+    int16_t table[2][2048];
+};
+
+struct Name {
+    const char* name;
+    uint8_t code;
+};
+
+// 命令名の対応表
+static const Name NAMES[] = {
+    {"SYNTH_NOTE_ON", SYNTH_NOTE_ON},
+    {"SYNTH_NOTE_OFF", SYNTH_NOTE_OFF},
+    {"SYNTH_SET_SHAPE", SYNTH_SET_SHAPE},
+    {"SYNTH_SOUND_STOP", SYNTH_SOUND_STOP},
+    {"SYNTH_SET_PAN", SYNTH_SET_PAN},
+    {"SYNTH_SET_ATTACK", SYNTH_SET_ATTACK},
+    {"SYNTH_SET_RELEASE", SYNTH_SET_RELEASE},
+    {"SYNTH_SET_DECAY", SYNTH_SET_DECAY},
+    {"SYNTH_SET_SUSTAIN", SYNTH_SET_SUSTAIN},
+    {"SYNTH_GET_USED", SYNTH_GET_USED},
+    {"SYNTH_IS_NOTE", SYNTH_IS_NOTE},
+    {"SYNTH_SET_CSHAPE", SYNTH_SET_CSHAPE},
+    {"SYNTH_SET_VOICE", SYNTH_SET_VOICE},
+    {"SYNTH_SET_DETUNE", SYNTH_SET_DETUNE},
+    {"SYNTH_SET_SPREAD", SYNTH_SET_SPREAD},
+    {"SYNTH_SET_OCT", SYNTH_SET_OCT},
+    {"SYNTH_SET_SEMI", SYNTH_SET_SEMI},
+    {"SYNTH_SET_CENT", SYNTH_SET_CENT},
+    {"SYNTH_SET_LEVEL", SYNTH_SET_LEVEL},
+    {"SYNTH_SET_OSC_LVL", SYNTH_SET_OSC_LVL},
+    {"SYNTH_SET_LPF", SYNTH_SET_LPF},
+    {"SYNTH_SET_HPF", SYNTH_SET_HPF},
+    {"SYNTH_SET_DELAY", SYNTH_SET_DELAY},
+    {"SYNTH_SET_MOD", SYNTH_SET_MOD},
+    {"SYNTH_SET_MONO", SYNTH_SET_MONO},
+    {"SYNTH_SET_GLIDE", SYNTH_SET_GLIDE},
+    {"SYNTH_RESET_PARAM", SYNTH_RESET_PARAM},
+    {"SYNTH_SET_CZSHAPE", SYNTH_SET_CZSHAPE},
+    {"SYNTH_SET_BATCH", SYNTH_SET_BATCH},
+    {"SYNTH_CTRL_CHANGE", SYNTH_CTRL_CHANGE},
+    {"SYNTH_PITCH_BEND", SYNTH_PITCH_BEND},
+    {"SYNTH_SET_OVERSAMPLE", SYNTH_SET_OVERSAMPLE},
+    {"SYNTH_SET_FM_INDEX", SYNTH_SET_FM_INDEX},
+    {"SYNTH_SET_OSC_PAN", SYNTH_SET_OSC_PAN},
+    {"SYNTH_SET_NOISE", SYNTH_SET_NOISE},
+    {"SYNTH_SCHEDULE", SYNTH_SCHEDULE},
+};
+
+static bool parseByte(const std::string& token, uint8_t* out) {
+    for(const Name& n : NAMES) {
+        if(token == n.name) {
+            *out = n.code;
+            return true;
+        }
+    }
+    char* end;
+    long value = strtol(token.c_str(), &end, 0);
+    if(*end != '\0') return false;
+    *out = (uint8_t)value;
+    return true;
+}
+
+/**
+ * @brief !patch / !cshape の行を読み込みます
+ */
+static bool loadHeader(const std::string& kind, std::istringstream& tokens, Header& header) {
+    int part = -1;
+    int osc = 0x01;
+    tokens >> part;
+    if(kind == "!cshape") tokens >> osc;
+    if(part < 0 || osc < 0x01 || osc > 0x02) return false;
+
+    std::vector<uint8_t> bytes;
+    std::string token;
+    while(tokens >> token) {
+        uint8_t b;
+        if(!parseByte(token, &b)) return false;
+        bytes.push_back(b);
+    }
+    if(part != 0) return true;
+
+    if(kind == "!patch") {
+        if(bytes.size() != sizeof(Patch)) return false;
+        memcpy(&header.patch, bytes.data(), sizeof(Patch));
+        header.has_patch = true;
+        return true;
+    }
+    if(kind == "!cshape") {
+        if(bytes.size() != sizeof(header.table[0])) return false;
+        memcpy(header.table[osc - 1], bytes.data(), sizeof(header.table[0]));
+        header.has_table[osc - 1] = true;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief 命令スクリプトを読み込みます
+ */
+static bool loadScript(const char* path, uint32_t rate, std::vector<Event>& events, Header& header) {
+    std::ifstream file(path);
+    if(!file) return false;
+    MidiParser parser;
+
+    std::string line;
+    int line_no = 0;
+    while(std::getline(file, line)) {
+        line_no++;
+        size_t comment = line.find('#');
+        if(comment != std::string::npos) line.erase(comment);
+
+        std::istringstream tokens(line);
+        std::string token;
+        if(!(tokens >> token)) continue;
+
+        if(token[0] == '!') {
+            if(!loadHeader(token, tokens, header)) {
+                fprintf(stderr, "%s:%d: invalid %s\n", path, line_no, token.c_str());
+                return false;
+            }
+            continue;
+        }
+
+        Event ev;
+        if(token[0] == '@') ev.sample = strtoull(token.c_str() + 1, nullptr, 10);
+        else ev.sample = (uint64_t)(strtod(token.c_str(), nullptr) * rate / 1000.0);
+
+        // MIDI バイト列 (完成したメッセージごとに命令にする)
+        std::streampos data_pos = tokens.tellg();
+        if(tokens >> token && token == "MIDI") {
+            while(tokens >> token) {
+                uint8_t b;
+                uint8_t command[3];
+                if(!parseByte(token, &b)) {
+                    fprintf(stderr, "%s:%d: unknown token '%s'\n", path, line_no, token.c_str());
+                    return false;
+                }
+                uint8_t size = parser.parse(b, command);
+                if(size > 0) events.push_back({ev.sample, std::vector<uint8_t>(command, command + size)});
+            }
+            continue;
+        }
+        tokens.clear();
+        tokens.seekg(data_pos);
+
+        while(tokens >> token) {
+            uint8_t b;
+            if(!parseByte(token, &b)) {
+                fprintf(stderr, "%s:%d: unknown token '%s'\n", path, line_no, token.c_str());
+                return false;
+            }
+            ev.data.push_back(b);
+        }
+        // {SYNTH_SCHEDULE, <delay LB>, <delay HB>, <命令...>}
+        if(ev.data.size() >= 4 && ev.data[0] == SYNTH_SCHEDULE) {
+            ev.sample += ev.data[1] | (ev.data[2] << 8);
+            ev.data.erase(ev.data.begin(), ev.data.begin() + 3);
+        }
+        if(!ev.data.empty()) events.push_back(ev);
+    }
+
+    std::stable_sort(events.begin(), events.end(),
+        [](const Event& a, const Event& b) { return a.sample < b.sample; });
+    return true;
+}
+
+static uint32_t readVarLen(const std::vector<uint8_t>& d, size_t& p, size_t end) {
+    uint32_t value = 0;
+    while(p < end) {
+        uint8_t b = d[p++];
+        value = (value << 7) | (b & 0x7F);
+        if(!(b & 0x80)) break;
+    }
+    return value;
+}
+
+static uint32_t readBE(const std::vector<uint8_t>& d, size_t p, uint8_t bytes) {
+    uint32_t value = 0;
+    for(uint8_t i = 0; i < bytes; ++i) value = (value << 8) | d[p + i];
+    return value;
+}
+
+struct MidiEvent {
+    uint64_t tick;
+    uint32_t tempo;             // テンポ変更 (0 = なし)
+    std::vector<uint8_t> bytes; // チャンネルメッセージ
+};
+
+/**
+ * @brief Standard MIDI File (フォーマット0/1) を読み込みます
+ * チャンネルメッセージは MidiParser で命令列に変換する
+ */
+static bool loadMidi(const char* path, uint32_t rate, std::vector<Event>& events) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file) return false;
+    std::vector<uint8_t> d((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if(d.size() < 14 || memcmp(&d[0], "MThd", 4) != 0) return false;
+    uint16_t tracks = readBE(d, 10, 2);
+    uint16_t division = readBE(d, 12, 2);
+    if(division & 0x8000) {
+        fprintf(stderr, "SMPTE time division is not supported\n");
+        return false;
+    }
+
+    std::vector<MidiEvent> list;
+    size_t p = 8 + readBE(d, 4, 4);
+    for(uint16_t t = 0; t < tracks && p + 8 <= d.size(); ++t) {
+        size_t length = readBE(d, p + 4, 4);
+        bool is_track = memcmp(&d[p], "MTrk", 4) == 0;
+        p += 8;
+        size_t end = std::min(p + length, d.size());
+        if(!is_track) {
+            p = end;
+            continue;
+        }
+
+        uint64_t tick = 0;
+        uint8_t status = 0;
+        while(p < end) {
+            tick += readVarLen(d, p, end);
+            if(p >= end) break;
+
+            uint8_t b = d[p];
+            if(b == 0xFF) {
+                // メタイベント (テンポのみ使用)
+                uint8_t type = d[p + 1];
+                p += 2;
+                uint32_t len = readVarLen(d, p, end);
+                if(type == 0x51 && len == 3) list.push_back({tick, readBE(d, p, 3), {}});
+                p += len;
+                continue;
+            }
+            if(b == 0xF0 || b == 0xF7) {
+                // システムエクスクルーシブは読み飛ばす
+                p++;
+                p += readVarLen(d, p, end);
+                continue;
+            }
+
+            if(b & 0x80) {
+                status = b;
+                p++;
+            }
+            if(status == 0) break;
+
+            uint8_t len = ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0) ? 1 : 2;
+            MidiEvent ev = {tick, 0, {status}};
+            for(uint8_t i = 0; i < len && p < end; ++i) ev.bytes.push_back(d[p++]);
+            list.push_back(ev);
+        }
+        p = end;
+    }
+
+    std::stable_sort(list.begin(), list.end(),
+        [](const MidiEvent& a, const MidiEvent& b) { return a.tick < b.tick; });
+
+    // テンポマップに沿ってサンプル位置へ変換
+    MidiParser parser;
+    uint32_t tempo = 500000; // us/四分音符
+    uint64_t last_tick = 0;
+    double seconds = 0.0;
+    for(const MidiEvent& m : list) {
+        seconds += (double)(m.tick - last_tick) * tempo / 1000000.0 / division;
+        last_tick = m.tick;
+        if(m.tempo != 0) {
+            tempo = m.tempo;
+            continue;
+        }
+
+        uint8_t command[3];
+        for(uint8_t b : m.bytes) {
+            uint8_t size = parser.parse(b, command);
+            if(size > 0) events.push_back({(uint64_t)(seconds * rate), std::vector<uint8_t>(command, command + size)});
+        }
+    }
+    return true;
+}
+
+static void writeLE(FILE* f, uint32_t value, uint8_t bytes) {
+    for(uint8_t i = 0; i < bytes; ++i) fputc((value >> (i * 8)) & 0xFF, f);
+}
+
+static void writeWavHeader(FILE* f, uint32_t rate, uint32_t frames) {
+    uint32_t data_size = frames * 4;
+    fwrite("RIFF", 1, 4, f);
+    writeLE(f, 36 + data_size, 4);
+    fwrite("WAVEfmt ", 1, 8, f);
+    writeLE(f, 16, 4);       // fmtチャンクサイズ
+    writeLE(f, 1, 2);        // PCM
+    writeLE(f, 2, 2);        // ステレオ
+    writeLE(f, rate, 4);
+    writeLE(f, rate * 4, 4); // バイト/秒
+    writeLE(f, 4, 2);        // ブロックアライン
+    writeLE(f, 16, 2);       // ビット数
+    fwrite("data", 1, 4, f);
+    writeLE(f, data_size, 4);
+}
+
+static bool hasSuffix(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    if(s.size() < n) return false;
+    std::string tail = s.substr(s.size() - n);
+    std::transform(tail.begin(), tail.end(), tail.begin(), ::tolower);
+    return tail == suffix;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: render [-o out.wav] [-r sample_rate] [-b block_size] [-t tail_sec] [-s seed] [-q] <input.txt|input.mid>\n");
+}
+
+int main(int argc, char** argv) {
+    const char* out_path = "out.wav";
+    const char* in_path = nullptr;
+    uint32_t rate = DEFAULT_RATE;
+    uint32_t block = DEFAULT_BLOCK;
+    double tail = DEFAULT_TAIL;
+    uint32_t seed = 0; // 0: 既定の種
+    bool quantize = false; // 全ての命令をブロック境界で適用
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) out_path = argv[++i];
+        else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc) rate = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) block = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) tail = atof(argv[++i]);
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed = strtoul(argv[++i], nullptr, 0);
+        else if(strcmp(argv[i], "-q") == 0) quantize = true;
+        else if(argv[i][0] != '-' && in_path == nullptr) in_path = argv[i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if(in_path == nullptr || rate == 0 || block == 0 || block > MAX_BLOCK) {
+        usage();
+        return 1;
+    }
+
+    std::vector<Event> events;
+    static Header header;
+    bool loaded = (hasSuffix(in_path, ".mid") || hasSuffix(in_path, ".midi"))
+        ? loadMidi(in_path, rate, events)
+        : loadScript(in_path, rate, events, header);
+    if(!loaded) {
+        fprintf(stderr, "failed to load %s\n", in_path);
+        return 1;
+    }
+
+    FILE* out = fopen(out_path, "wb");
+    if(out == nullptr) {
+        fprintf(stderr, "failed to open %s\n", out_path);
+        return 1;
+    }
+    writeWavHeader(out, rate, 0);
+
+    static uint8_t arena_buffer[ARENA_SIZE] __attribute__((aligned(4)));
+    static SramArena arena(arena_buffer, ARENA_SIZE);
+    static WaveGenerator wave(rate);
+    wave.setArena(&arena, 0);
+    wave.setSeed(seed); // 位相・ノイズの乱数 (同じ種なら同じ出力)
+    static CommandDecoder command(wave);
+    if(header.has_patch) {
+        const int16_t* osc1_table = header.has_table[0] ? header.table[0] : nullptr;
+        const int16_t* osc2_table = header.has_table[1] ? header.table[1] : nullptr;
+        if(!wave.setPatch(header.patch, osc1_table, osc2_table)) {
+            fprintf(stderr, "failed to apply !patch\n");
+            return 1;
+        }
+    }
+    static uint32_t frames[MAX_BLOCK];
+    uint32_t* delay_long = wave.getDelayLong();
+    uint32_t remain = 0;
+    uint8_t response = 0x00;
+
+    uint64_t last = events.empty() ? 0 : events.back().sample;
+    uint64_t limit = last + (uint64_t)(tail * rate);
+    uint64_t pos = 0;
+    size_t next = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    double generate_sec = 0.0;
+
+    // ブロック内で適用できる次の演奏命令
+    auto nextTimed = [&](uint64_t end) {
+        return !quantize && next < events.size() && events[next].sample < end
+            && EventQueue::isTimed(events[next].data[0]);
+    };
+
+    while(pos < limit) {
+        // 到達した命令を適用
+        while(next < events.size() && events[next].sample <= pos) {
+            const std::vector<uint8_t>& data = events[next].data;
+            if(data[0] == SYNTH_SET_BATCH) command.applyBatch(data.data(), data.size(), &response);
+            else command.process(data.data(), data.size(), &response);
+            next++;
+        }
+
+        wave.releasePending();
+        if(wave.isGenerating()) {
+            // 発音中はブロック単位で生成 (演奏命令の位置で区切る)
+            remain = *delay_long;
+            auto t = std::chrono::steady_clock::now();
+            wave.beginBlock();
+            uint32_t offset = 0;
+            while(offset < block) {
+                uint32_t end = block;
+                if(nextTimed(pos + block)) end = events[next].sample - pos;
+                if(end > offset) wave.generateSpan(frames, offset, end - offset);
+                offset = end;
+                while(offset < block && nextTimed(pos + offset + 1)) {
+                    command.process(events[next].data.data(), events[next].data.size(), &response);
+                    next++;
+                }
+            }
+            wave.endBlock(block);
+            generate_sec += std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+            for(uint32_t i = 0; i < block; ++i) {
+                writeLE(out, (uint16_t)FRAME_L(frames[i]), 2);
+                writeLE(out, (uint16_t)FRAME_R(frames[i]), 2);
+            }
+            pos += block;
+        }
+        else {
+            // 無音時はディレイの残りを1サンプルずつ出力
+            if(next >= events.size() && (!wave.isDelayEnabled() || remain == 0)) break;
+            int16_t L = 0, R = 0;
+            if(wave.isDelayEnabled() && remain > 0) {
+                L = wave.delayProcess(0, 0x00);
+                R = wave.delayProcess(0, 0x01);
+                remain--;
+            }
+            writeLE(out, (uint16_t)L, 2);
+            writeLE(out, (uint16_t)R, 2);
+            pos++;
+        }
+    }
+
+    fseek(out, 0, SEEK_SET);
+    writeWavHeader(out, rate, (uint32_t)pos);
+    fclose(out);
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double audio = (double)pos / rate;
+    fprintf(stderr, "%s: %.2f s rendered in %.3f s (%.1fx realtime, generate %.2f ms)\n",
+        out_path, audio, elapsed, elapsed > 0 ? audio / elapsed : 0.0, generate_sec * 1000);
+    return 0;
+}
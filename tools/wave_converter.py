@@ -33,10 +33,58 @@ def read_and_normalize_wave(filename):
     
     return scaled_data
 
+def encode_compressed(samples):
+    """Encode a 2048-sample table for SYNTH_SET_CZSHAPE (see src/wave_decoder.h)."""
+    out = bytearray()
+    x1 = x2 = 0
+    zeros = 0
+
+    def flush_zeros():
+        nonlocal zeros
+        while zeros > 0:
+            run = min(zeros, 64)
+            out.append(run - 1)
+            zeros -= run
+
+    for x in (int(v) for v in samples):
+        # 2次線形予測の残差
+        residual = x - (2 * x1 - x2)
+        if residual == 0:
+            zeros += 1
+        else:
+            flush_zeros()
+            if -32 <= residual <= 31:
+                out.append(0x60 + residual)
+            elif -16384 <= residual <= 16127:
+                value = residual + 16384
+                out.append(0x80 | (value >> 8))
+                out.append(value & 0xFF)
+            else:
+                # 範囲外は生サンプル
+                out.append(0xFF)
+                out += (x & 0xFFFF).to_bytes(2, 'little')
+        x2, x1 = x1, x
+    flush_zeros()
+    return bytes(out)
+
+def build_frames(encoded, osc, chunk=24):
+    """Split encoded data into SYNTH_SET_CZSHAPE frames."""
+    frames = []
+    for i in range(0, len(encoded), chunk):
+        first = 0x01 if i == 0 else 0x00
+        frames.append(bytes([0xD9, first, osc]) + encoded[i:i + chunk])
+    return frames
+
 # Read and normalize the wave file data
 normalized_wave_data = read_and_normalize_wave(filename)
 
 comma_separated_str = ", ".join(map(str, normalized_wave_data.flatten()))
 print(comma_separated_str)
 
+# 圧縮形式 (SYNTH_SET_CZSHAPE)
+encoded = encode_compressed(normalized_wave_data.flatten()[:2048])
+print()
+print(", ".join("0x%02X" % b for b in encoded))
+print("# %d bytes, %d frames (raw: 171 frames)" % (len(encoded), len(build_frames(encoded, 0x01))))
+
 #[-16383, 16384]
\ No newline at end of file